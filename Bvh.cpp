@@ -0,0 +1,501 @@
+
+#include "Bvh.h"
+#include "OctreeSimd.h"
+
+// below this depth nodes are split in half instead of at the SAH plane, so
+// the tree (and the traversal stack) stays shallow on degenerate meshes
+//
+static const int MaxSahDepth = 48;
+static const int MaxStack = 256;
+
+static float surfaceArea(const Box & box) {
+	Vector3 d = box.max() - box.min();
+	return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+}
+
+static void grow(Box & box, const Box & b) {
+	const Vector3 & lo = box.parameters[0], & hi = box.parameters[1];
+	const Vector3 & blo = b.parameters[0], & bhi = b.parameters[1];
+	box.parameters[0] = Vector3(std::min(lo.x(), blo.x()), std::min(lo.y(), blo.y()), std::min(lo.z(), blo.z()));
+	box.parameters[1] = Vector3(std::max(hi.x(), bhi.x()), std::max(hi.y(), bhi.y()), std::max(hi.z(), bhi.z()));
+}
+
+static Box emptyBox() {
+	return Box(Vector3(FLT_MAX, FLT_MAX, FLT_MAX), Vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+}
+
+// faces are read from the mesh's index list, or from consecutive vertices
+// when the mesh has no indices (as in the Octree)
+//
+int Bvh::numFaces() const {
+	return mesh.getNumIndices() > 0 ? mesh.getNumIndices() / 3 : mesh.getNumVertices() / 3;
+}
+
+int Bvh::faceVertex(int face, int k) const {
+	return mesh.getNumIndices() > 0 ? mesh.getIndex(3 * face + k) : 3 * face + k;
+}
+
+// build:  compute the box and centroid of every triangle, then split the
+//         root recursively.  The build is serial; numThreads is only there
+//         for the SpatialIndex interface.
+//
+void Bvh::build(const ofMesh & geo, int /*numThreads*/) {
+	float timeToBuild = ofGetElapsedTimeMillis();
+	mesh = geo;
+	nodes.clear();
+	depth = 0;
+	int n = numFaces();
+	faces.resize(n);
+	vector<Box> faceBoxes(n);
+	vector<Vector3> centers(n);
+	for (int i = 0; i < n; i++) {
+		faces[i] = i;
+		Box b = emptyBox();
+		for (int k = 0; k < 3; k++) {
+			ofVec3f v = mesh.getVertex(faceVertex(i, k));
+			grow(b, Box(Vector3(v.x, v.y, v.z), Vector3(v.x, v.y, v.z)));
+		}
+		faceBoxes[i] = b;
+		centers[i] = b.center();
+	}
+
+	if (n > 0) {
+		nodes.reserve(2 * (n / maxLeafFaces + 1));
+		nodes.push_back(BvhNode());
+		nodes[0].begin = 0;
+		nodes[0].end = n;
+		nodes[0].box = bounds(0, n, faceBoxes);
+		split(0, 0, faceBoxes, centers);
+	}
+	loadFaceData();
+
+	cout << "Time to build bvh: " << ofGetElapsedTimeMillis() - timeToBuild << "ms" << endl;
+	cout << "Bvh memory: " << memoryUsage() / 1024 << "KB, " << nodes.size() << " nodes, depth " << depth << endl;
+}
+
+// bounds of the triangles faces[begin, end)
+//
+Box Bvh::bounds(int begin, int end, const vector<Box> & faceBoxes) const {
+	Box box = emptyBox();
+	for (int i = begin; i < end; i++) grow(box, faceBoxes[faces[i]]);
+	return box;
+}
+
+// split:  split node i in two at the cheapest of the bin boundaries of the
+//         triangle centroids on each axis, by the surface area heuristic
+//         (area of child box times its number of triangles, summed over the
+//         two children).  Triangles whose centroids all coincide, and nodes
+//         below MaxSahDepth, are split in half instead.
+//
+void Bvh::split(int i, int level, const vector<Box> & faceBoxes, const vector<Vector3> & centers) {
+	int begin = nodes[i].begin, end = nodes[i].end;
+	int n = end - begin;
+	depth = std::max(depth, level);
+	if (n <= maxLeafFaces) return;
+
+	Box c = emptyBox();
+	for (int f = begin; f < end; f++) grow(c, Box(centers[faces[f]], centers[faces[f]]));
+
+	float bestCost = FLT_MAX;
+	int bestAxis = -1, bestBin = 0;
+	vector<Box> binBox(numBins);
+	vector<int> binCount(numBins);
+	vector<float> rightArea(numBins);
+	vector<int> rightCount(numBins);
+	for (int a = 0; a < 3 && level < MaxSahDepth; a++) {
+		float lo = c.parameters[0][a], extent = c.parameters[1][a] - lo;
+		if (!(extent > 0)) continue;
+		float scale = numBins / extent;
+		for (int b = 0; b < numBins; b++) {
+			binBox[b] = emptyBox();
+			binCount[b] = 0;
+		}
+		for (int f = begin; f < end; f++) {
+			int b = std::min(numBins - 1, (int)((centers[faces[f]][a] - lo) * scale));
+			grow(binBox[b], faceBoxes[faces[f]]);
+			binCount[b]++;
+		}
+
+		// sweep from the right for the area and count above each plane, then
+		// from the left evaluating the cost of each plane
+		//
+		Box right = emptyBox();
+		int count = 0;
+		for (int b = numBins - 1; b > 0; b--) {
+			grow(right, binBox[b]);
+			count += binCount[b];
+			rightArea[b] = count ? surfaceArea(right) : 0;
+			rightCount[b] = count;
+		}
+		Box left = emptyBox();
+		count = 0;
+		for (int b = 0; b < numBins - 1; b++) {
+			grow(left, binBox[b]);
+			count += binCount[b];
+			if (count == 0 || rightCount[b + 1] == 0) continue;
+			float cost = surfaceArea(left) * count + rightArea[b + 1] * rightCount[b + 1];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = a;
+				bestBin = b;
+			}
+		}
+	}
+
+	int mid = begin + n / 2;
+	if (bestAxis >= 0) {
+		float lo = c.parameters[0][bestAxis];
+		float scale = numBins / (c.parameters[1][bestAxis] - lo);
+		mid = std::partition(faces.begin() + begin, faces.begin() + end, [&](int f) {
+			return std::min(numBins - 1, (int)((centers[f][bestAxis] - lo) * scale)) <= bestBin;
+		}) - faces.begin();
+	}
+
+	int first = nodes.size();
+	nodes.push_back(BvhNode());
+	nodes.push_back(BvhNode());
+	nodes[i].firstChild = first;
+	nodes[first].begin = begin;
+	nodes[first].end = mid;
+	nodes[first].box = bounds(begin, mid, faceBoxes);
+	nodes[first + 1].begin = mid;
+	nodes[first + 1].end = end;
+	nodes[first + 1].box = bounds(mid, end, faceBoxes);
+	split(first, level + 1, faceBoxes, centers);
+	split(first + 1, level + 1, faceBoxes, centers);
+}
+
+// loadFaceData:  copy the triangles into faceData in "faces" order for the
+//                SIMD kernel, with three empty triangles at the end to keep
+//                4-wide loads in bounds
+//
+void Bvh::loadFaceData() {
+	int n = faces.size();
+	for (int k = 0; k < 9; k++) faceData[k].assign(n + 3, 0.0f);
+	for (int i = 0; i < n; i++) {
+		ofVec3f v0 = mesh.getVertex(faceVertex(faces[i], 0));
+		ofVec3f e1 = mesh.getVertex(faceVertex(faces[i], 1)) - v0;
+		ofVec3f e2 = mesh.getVertex(faceVertex(faces[i], 2)) - v0;
+		faceData[0][i] = v0.x; faceData[1][i] = v0.y; faceData[2][i] = v0.z;
+		faceData[3][i] = e1.x; faceData[4][i] = e1.y; faceData[5][i] = e1.z;
+		faceData[6][i] = e2.x; faceData[7][i] = e2.y; faceData[8][i] = e2.z;
+	}
+}
+
+// refit:  recompute every box from the mesh, children before parents (they
+//         always come after their parent in the array)
+//
+void Bvh::refit() {
+	for (int i = nodes.size() - 1; i >= 0; i--) {
+		BvhNode & node = nodes[i];
+		if (!node.isLeaf()) {
+			node.box = nodes[node.firstChild].box;
+			grow(node.box, nodes[node.firstChild + 1].box);
+			continue;
+		}
+		node.box = emptyBox();
+		for (int f = node.begin; f < node.end; f++) {
+			for (int k = 0; k < 3; k++) {
+				ofVec3f v = mesh.getVertex(faceVertex(faces[f], k));
+				grow(node.box, Box(Vector3(v.x, v.y, v.z), Vector3(v.x, v.y, v.z)));
+			}
+		}
+	}
+}
+
+// moveVertices:  move the mesh vertices and refit the tree.  The topology
+//                is kept, so a heavily deformed mesh should be rebuilt.  The
+//                whole tree is refit, which is cheap next to a rebuild.
+//
+bool Bvh::moveVertices(const vector<int> & verts, const vector<ofVec3f> & pos) {
+	for (int i = 0; i < verts.size(); i++)
+		mesh.setVertex(verts[i], pos[i]);
+	loadFaceData();
+	refit();
+	return true;
+}
+
+size_t Bvh::memoryUsage() const {
+	return nodes.capacity() * sizeof(BvhNode) + faces.capacity() * sizeof(int) +
+		faceData[0].capacity() * sizeof(float) * 9;
+}
+
+// ray query:  closest triangle hit inside (tMin, tMax).  The nearer child is
+//             visited first and a node is skipped once the ray enters it
+//             beyond the best hit so far.
+//
+bool Bvh::intersect(const Ray &ray, RayHit & hit, float tMin, float tMax) const {
+	hit = RayHit();
+	hit.t = tMax;
+	if (nodes.empty()) return false;
+
+	const float o[3] = { ray.origin.x(), ray.origin.y(), ray.origin.z() };
+	const float d[3] = { ray.direction.x(), ray.direction.y(), ray.direction.z() };
+	const float *tri[9];
+	for (int k = 0; k < 9; k++) tri[k] = faceData[k].data();
+
+	int stack[MaxStack];
+	float stackT[MaxStack];
+	int top = 0;
+	if (!nodes[0].box.intersect(ray, tMin, tMax, stackT[0])) return false;
+	stack[top++] = 0;
+	while (top > 0) {
+		top--;
+		if (stackT[top] >= hit.t) continue;
+		int i = stack[top];
+		const BvhNode & node = nodes[i];
+		if (node.isLeaf()) {
+			for (int f = node.begin; f < node.end; f += 4) {
+				float t[4], u[4], v[4];
+				int mask = rayTriangles4(o, d, tri, f, tMin, hit.t, t, u, v);
+				if (node.end - f < 4) mask &= (1 << (node.end - f)) - 1;
+				for (int k = 0; mask; k++, mask >>= 1) {
+					if ((mask & 1) && t[k] < hit.t) {
+						hit.t = t[k];
+						hit.u = u[k];
+						hit.v = v[k];
+						hit.index = faces[f + k];
+						hit.node = i;
+					}
+				}
+			}
+			continue;
+		}
+
+		int a = node.firstChild, b = a + 1;
+		float ta, tb;
+		bool hitA = nodes[a].box.intersect(ray, tMin, hit.t, ta);
+		bool hitB = nodes[b].box.intersect(ray, tMin, hit.t, tb);
+		if (hitA && hitB && tb < ta) {
+			std::swap(a, b);
+			std::swap(ta, tb);
+		}
+		else if (!hitA) {
+			a = b;
+			ta = tb;
+			hitA = hitB;
+			hitB = false;
+		}
+		if (hitB) {
+			stack[top] = b;
+			stackT[top++] = tb;
+		}
+		if (hitA) {
+			stack[top] = a;
+			stackT[top++] = ta;
+		}
+	}
+	if (hit.index < 0) return false;
+	hit.point = ray.origin + ray.direction * hit.t;
+	return true;
+}
+
+// intersectSwept:  earliest time of impact of "box" moving by "move" with a
+//                  triangle (see Octree::intersectSwept()).  The nodes are
+//                  grown by the box's half size and visited in the order
+//                  the box's center enters them.
+//
+bool Bvh::intersectSwept(const Box &box, const Vector3 & move, RayHit & hit) const {
+	hit = RayHit();
+	hit.t = 1;
+	if (nodes.empty() || move.length() == 0) return false;
+
+	Vector3 half = (box.max() - box.min()) / 2;
+	Ray ray(box.center(), move);
+	auto enters = [&](const BvhNode & node, float & tRtn) {
+		return Box(node.box.min() - half, node.box.max() + half).intersect(ray, 0, hit.t, tRtn);
+	};
+
+	int stack[MaxStack];
+	float stackT[MaxStack];
+	int top = 0;
+	if (!enters(nodes[0], stackT[0])) return false;
+	stack[top++] = 0;
+	while (top > 0) {
+		top--;
+		if (stackT[top] >= hit.t) continue;
+		int i = stack[top];
+		const BvhNode & node = nodes[i];
+		if (node.isLeaf()) {
+			for (int f = node.begin; f < node.end; f++) {
+				Vector3 tri[3];
+				tri[0] = Vector3(faceData[0][f], faceData[1][f], faceData[2][f]);
+				tri[1] = tri[0] + Vector3(faceData[3][f], faceData[4][f], faceData[5][f]);
+				tri[2] = tri[0] + Vector3(faceData[6][f], faceData[7][f], faceData[8][f]);
+				float t;
+				Vector3 normal;
+				if (sweepTriangle(box, move, tri, t, normal) && t < hit.t) {
+					hit.t = t;
+					hit.index = faces[f];
+					hit.node = i;
+					hit.normal = normal;
+				}
+			}
+			continue;
+		}
+
+		int a = node.firstChild, b = a + 1;
+		float ta, tb;
+		bool hitA = enters(nodes[a], ta);
+		bool hitB = enters(nodes[b], tb);
+		if (hitA && hitB && tb < ta) {
+			std::swap(a, b);
+			std::swap(ta, tb);
+		}
+		else if (!hitA) {
+			a = b;
+			ta = tb;
+			hitA = hitB;
+			hitB = false;
+		}
+		if (hitB) {
+			stack[top] = b;
+			stackT[top++] = tb;
+		}
+		if (hitA) {
+			stack[top] = a;
+			stackT[top++] = ta;
+		}
+	}
+	if (hit.index < 0) return false;
+	hit.point = ray.origin + move * hit.t;
+	return true;
+}
+
+// box query:  collect the boxes of all leaves that overlap "box"
+//
+bool Bvh::intersect(const Box &box, vector<Box> & boxListRtn) const {
+	if (nodes.empty() || !nodes[0].box.overlap(box)) return false;
+
+	bool intersects = false;
+	int stack[MaxStack];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const BvhNode & node = nodes[stack[--top]];
+		if (node.isLeaf()) {
+			boxListRtn.push_back(node.box);
+			intersects = true;
+			continue;
+		}
+		for (int c = node.firstChild + 1; c >= node.firstChild; c--) {
+			if (nodes[c].box.overlap(box)) stack[top++] = c;
+		}
+	}
+	return intersects;
+}
+
+// intersectTop:  any-hit test that also returns the highest top of the
+//                leaves overlapping "box"; the higher child is visited first
+//                and subtrees below the best top so far are skipped
+//
+bool Bvh::intersectTop(const Box &box, float & topRtn, int maxDepth) const {
+	if (nodes.empty() || !nodes[0].box.overlap(box)) return false;
+
+	bool found = false;
+	float best = -FLT_MAX;
+	int stack[MaxStack];
+	int stackDepth[MaxStack];
+	int top = 0;
+	stack[top] = 0;
+	stackDepth[top++] = 0;
+	while (top > 0) {
+		top--;
+		const BvhNode & node = nodes[stack[top]];
+		int level = stackDepth[top];
+		float nodeTop = node.box.max().y();
+		if (found && nodeTop <= best) continue;
+		if (node.isLeaf() || level >= maxDepth) {
+			best = nodeTop;
+			found = true;
+			continue;
+		}
+		int a = node.firstChild, b = a + 1;
+		if (nodes[b].box.max().y() > nodes[a].box.max().y()) std::swap(a, b);
+		if (nodes[b].box.overlap(box)) {
+			stack[top] = b;
+			stackDepth[top++] = level + 1;
+		}
+		if (nodes[a].box.overlap(box)) {
+			stack[top] = a;
+			stackDepth[top++] = level + 1;
+		}
+	}
+	if (found) topRtn = best;
+	return found;
+}
+
+// squared distance from p to a box (0 inside it)
+//
+static float boxDist2(const Box & box, const ofVec3f & p) {
+	float d2 = 0;
+	for (int a = 0; a < 3; a++) {
+		float d = std::max(box.parameters[0][a] - p[a], p[a] - box.parameters[1][a]);
+		if (d > 0) d2 += d * d;
+	}
+	return d2;
+}
+
+// knn:  the k mesh vertices nearest to p, closest first.  Best-first search
+//       over the nodes as in Octree::knn(); a vertex shared by several
+//       triangles is counted once.
+//
+int Bvh::knn(const ofVec3f & p, int k, vector<PointHit> & hits) const {
+	return knn(p, k, hits, QueryContext::local());
+}
+
+int Bvh::knn(const ofVec3f & p, int k, vector<PointHit> & hits, QueryContext & context) const {
+	hits.clear();
+	if (nodes.empty() || k <= 0) return 0;
+
+	typedef std::pair<float, int> Entry;		// squared distance, node or vertex
+	auto farther = [](const Entry & a, const Entry & b) { return a.first > b.first; };
+	vector<Entry> & open = context.open;		// min-heap of nodes
+	vector<Entry> & best = context.best;		// max-heap of the k best vertices
+	open.clear();
+	best.clear();
+
+	open.push_back(Entry(boxDist2(nodes[0].box, p), 0));
+	while (!open.empty()) {
+		Entry e = open.front();
+		if (best.size() == k && e.first > best.front().first) break;
+		std::pop_heap(open.begin(), open.end(), farther);
+		open.pop_back();
+
+		const BvhNode & node = nodes[e.second];
+		if (node.isLeaf()) {
+			for (int f = node.begin; f < node.end; f++) {
+				for (int c = 0; c < 3; c++) {
+					int v = faceVertex(faces[f], c);
+					ofVec3f d = mesh.getVertex(v) - p;
+					float d2 = d.x * d.x + d.y * d.y + d.z * d.z;
+					if (best.size() == k && d2 >= best.front().first) continue;
+					bool seen = false;
+					for (int j = 0; j < best.size() && !seen; j++) seen = best[j].second == v;
+					if (seen) continue;
+					best.push_back(Entry(d2, v));
+					std::push_heap(best.begin(), best.end());
+					if (best.size() > k) {
+						std::pop_heap(best.begin(), best.end());
+						best.pop_back();
+					}
+				}
+			}
+			continue;
+		}
+		for (int c = node.firstChild; c <= node.firstChild + 1; c++) {
+			float d2 = boxDist2(nodes[c].box, p);
+			if (best.size() == k && d2 > best.front().first) continue;
+			open.push_back(Entry(d2, c));
+			std::push_heap(open.begin(), open.end(), farther);
+		}
+	}
+
+	std::sort_heap(best.begin(), best.end());
+	hits.resize(best.size());
+	for (int i = 0; i < best.size(); i++) {
+		hits[i].index = best[i].second;
+		hits[i].dist = sqrtf(best[i].first);
+	}
+	return hits.size();
+}
@@ -0,0 +1,51 @@
+//--------------------------------------------------------------
+//
+//  Bvh:  bounding volume hierarchy over the triangles of a mesh, built top
+//  down with a binned surface area heuristic (SAH).  Its nodes follow the
+//  triangles rather than a fixed grid, so unlike the Octree it stays
+//  balanced on terrains whose vertex density is very uneven.
+//
+#pragma once
+#include "SpatialIndex.h"
+
+//  Node of the flat node array.  The two children of an interior node are
+//  stored together at firstChild and firstChild + 1, after their parent; a
+//  leaf's triangles are the run [begin, end) of Bvh::faces.
+//
+class BvhNode {
+public:
+	Box box;
+	int firstChild = -1;
+	int begin = 0, end = 0;
+
+	bool isLeaf() const { return firstChild < 0; }
+};
+
+class Bvh : public SpatialIndex {
+public:
+	void build(const ofMesh & mesh, int numThreads = 1);
+	void split(int node, int depth, const vector<Box> & faceBoxes, const vector<Vector3> & centers);
+	Box bounds(int begin, int end, const vector<Box> & faceBoxes) const;
+	void loadFaceData();
+	void refit();
+	int numFaces() const;
+	int faceVertex(int face, int k) const;
+
+	bool intersect(const Ray &, RayHit & hit, float tMin = 0, float tMax = FLT_MAX) const;
+	bool intersect(const Box &, vector<Box> & boxListRtn) const;
+	bool intersectTop(const Box &, float & topRtn, int maxDepth = INT_MAX) const;
+	bool intersectSwept(const Box &, const Vector3 & move, RayHit & hit) const;
+	int knn(const ofVec3f & p, int k, vector<PointHit> & hits) const;
+	int knn(const ofVec3f & p, int k, vector<PointHit> & hits, QueryContext & context) const;
+	bool moveVertices(const vector<int> & verts, const vector<ofVec3f> & pos);
+	size_t memoryUsage() const;
+	const char *name() const { return "bvh"; }
+
+	ofMesh mesh;
+	vector<BvhNode> nodes;
+	vector<int> faces;			// triangle indices, permuted so leaves are contiguous runs
+	vector<float> faceData[9];	// v0, edge1, edge2 (x, y, z) of triangle faces[i], SoA
+	int maxLeafFaces = 4;		// split nodes with more triangles than this
+	int numBins = 16;			// SAH candidate planes per axis
+	int depth = 0;				// depth of the deepest leaf (the root is 0)
+};
@@ -0,0 +1,55 @@
+//--------------------------------------------------------------
+//
+//  Frustum:  the six planes of a camera's view volume, taken from a
+//  projection * view * model matrix so that they are in the model's own
+//  space (that of the mesh an Octree is built on).  The planes face inward.
+//
+#pragma once
+#include "ofMain.h"
+#include "box.h"
+
+class Frustum {
+public:
+	Frustum() {}
+
+	// planes from the rows of m (Gribb & Hartmann); glm matrices are
+	// indexed m[column][row]
+	//
+	Frustum(const glm::mat4 & m) {
+		for (int i = 0; i < 3; i++) {
+			for (int s = 0; s < 2; s++) {
+				float sign = s == 0 ? 1.0f : -1.0f;
+				float *p = planes[2 * i + s];
+				for (int c = 0; c < 4; c++) p[c] = m[c][3] + sign * m[c][i];
+				float len = sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+				if (len > 0) for (int c = 0; c < 4; c++) p[c] /= len;
+			}
+		}
+	}
+
+	// -1 if "box" is outside, 1 if it is inside, 0 if it crosses a plane.
+	// Boxes near a corner of the frustum can count as crossing when they
+	// are outside; that only costs a few extra nodes.
+	//
+	int classify(const Box & box) const {
+		const Vector3 & lo = box.parameters[0], & hi = box.parameters[1];
+		int result = 1;
+		for (int i = 0; i < 6; i++) {
+			const float *p = planes[i];
+
+			// the corners furthest along the plane normal and against it
+			float outer = p[3], inner = p[3];
+			outer += p[0] * (p[0] > 0 ? hi.x() : lo.x());
+			outer += p[1] * (p[1] > 0 ? hi.y() : lo.y());
+			outer += p[2] * (p[2] > 0 ? hi.z() : lo.z());
+			if (outer < 0) return -1;
+			inner += p[0] * (p[0] > 0 ? lo.x() : hi.x());
+			inner += p[1] * (p[1] > 0 ? lo.y() : hi.y());
+			inner += p[2] * (p[2] > 0 ? lo.z() : hi.z());
+			if (inner < 0) result = 0;
+		}
+		return result;
+	}
+
+	float planes[6][4] = {};	// a x + b y + c z + d >= 0 inside
+};
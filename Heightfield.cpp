@@ -0,0 +1,404 @@
+#include "Heightfield.h"
+
+static int clampi(int i, int lo, int hi) {
+	return std::min(std::max(i, lo), hi);
+}
+
+static int numFaces(const ofMesh & mesh) {
+	return mesh.getNumIndices() > 0 ? mesh.getNumIndices() / 3 : mesh.getNumVertices() / 3;
+}
+
+static ofVec3f faceVertex(const ofMesh & mesh, int face, int k) {
+	return mesh.getVertex(mesh.getNumIndices() > 0 ? mesh.getIndex(3 * face + k) : 3 * face + k);
+}
+
+// build:  sample the top surface of "mesh" on a grid of "resolution" points
+//         along its longer side (0 picks about one sample per vertex), then
+//         build the max pyramid over it
+//
+void Heightfield::build(const ofMesh & mesh, int resolution) {
+	float timeToBuild = ofGetElapsedTimeMillis();
+	int n = mesh.getNumVertices();
+	ofVec3f lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int i = 0; i < n; i++) {
+		ofVec3f v = mesh.getVertex(i);
+		lo.x = std::min(lo.x, v.x); lo.y = std::min(lo.y, v.y); lo.z = std::min(lo.z, v.z);
+		hi.x = std::max(hi.x, v.x); hi.y = std::max(hi.y, v.y); hi.z = std::max(hi.z, v.z);
+	}
+	if (n == 0) lo = hi = ofVec3f(0, 0, 0);
+	ofVec3f size = hi - lo;
+	float side = std::max(std::max(size.x, size.z), 1e-6f);
+	if (resolution <= 0) {
+		float spacing = sqrtf(std::max(size.x * size.z, side * side * 1e-6f) / std::max(n, 1));
+		resolution = side / std::max(spacing, 1e-6f) + 1;
+	}
+	resolution = clampi(resolution, 2, 8192);
+	float step = side / (resolution - 1);
+	nx = std::max(2, (int)ceilf(size.x / step) + 1);
+	nz = std::max(2, (int)ceilf(size.z / step) + 1);
+	x0 = lo.x;
+	z0 = lo.z;
+	dx = dz = step;
+	if (overhangHeight <= 0) overhangHeight = std::max(size.y, 1e-6f) * 0.001f;
+
+	heights.assign(nx * nz, -FLT_MAX);
+	overhangs.assign(nx * nz, 0);
+	blocksX = (nx + blockSize - 1) / blockSize;
+	blocksZ = (nz + blockSize - 1) / blockSize;
+	blocks.assign(blocksX * blocksZ, vector<int>());
+
+	for (int f = 0; f < numFaces(mesh); f++) {
+		ofVec3f v[3] = { faceVertex(mesh, f, 0), faceVertex(mesh, f, 1), faceVertex(mesh, f, 2) };
+		float gx0 = (std::min(v[0].x, std::min(v[1].x, v[2].x)) - x0) / dx;
+		float gx1 = (std::max(v[0].x, std::max(v[1].x, v[2].x)) - x0) / dx;
+		float gz0 = (std::min(v[0].z, std::min(v[1].z, v[2].z)) - z0) / dz;
+		float gz1 = (std::max(v[0].z, std::max(v[1].z, v[2].z)) - z0) / dz;
+		int bx0 = clampi((int)gx0 / blockSize, 0, blocksX - 1), bx1 = clampi((int)gx1 / blockSize, 0, blocksX - 1);
+		int bz0 = clampi((int)gz0 / blockSize, 0, blocksZ - 1), bz1 = clampi((int)gz1 / blockSize, 0, blocksZ - 1);
+		for (int bz = bz0; bz <= bz1; bz++)
+			for (int bx = bx0; bx <= bx1; bx++) blocks[bz * blocksX + bx].push_back(f);
+		rasterize(mesh, f, 0, 0, nx - 1, nz - 1);
+	}
+
+	levels.clear();
+	levelWidth.clear();
+	levelHeight.clear();
+	int w = nx - 1, h = nz - 1;
+	while (true) {
+		levels.push_back(vector<float>(w * h));
+		levelWidth.push_back(w);
+		levelHeight.push_back(h);
+		if (w == 1 && h == 1) break;
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+	}
+	buildLevels(0, 0, nx - 2, nz - 2);
+
+	cout << "Time to build heightfield: " << ofGetElapsedTimeMillis() - timeToBuild << "ms" << endl;
+	cout << "Heightfield memory: " << memoryUsage() / 1024 << "KB, " << nx << " x " << nz << " samples, " << levels.size() << " levels" << endl;
+}
+
+// rasterize:  write the height of triangle "face" at the samples it covers
+//             in [i0, i1] x [j0, j1].  The highest surface is kept; a
+//             sample covered at two different heights is an overhang.
+//
+void Heightfield::rasterize(const ofMesh & mesh, int face, int i0, int j0, int i1, int j1) {
+	ofVec3f a = faceVertex(mesh, face, 0), b = faceVertex(mesh, face, 1), c = faceVertex(mesh, face, 2);
+	float area = (b.x - a.x) * (c.z - a.z) - (c.x - a.x) * (b.z - a.z);
+	if (fabs(area) < 1e-12f) return;		// edge on from above
+	float eps = -1e-5f * fabs(area);
+
+	int si0 = std::max(i0, (int)ceilf((std::min(a.x, std::min(b.x, c.x)) - x0) / dx));
+	int si1 = std::min(i1, (int)floorf((std::max(a.x, std::max(b.x, c.x)) - x0) / dx));
+	int sj0 = std::max(j0, (int)ceilf((std::min(a.z, std::min(b.z, c.z)) - z0) / dz));
+	int sj1 = std::min(j1, (int)floorf((std::max(a.z, std::max(b.z, c.z)) - z0) / dz));
+	for (int j = sj0; j <= sj1; j++) {
+		float z = z0 + j * dz;
+		for (int i = si0; i <= si1; i++) {
+			float x = x0 + i * dx;
+
+			// barycentric weights from the signed areas in the xz plane
+			float wa = (b.x - x) * (c.z - z) - (c.x - x) * (b.z - z);
+			float wb = (c.x - x) * (a.z - z) - (a.x - x) * (c.z - z);
+			float wc = (a.x - x) * (b.z - z) - (b.x - x) * (a.z - z);
+			if (area < 0) { wa = -wa; wb = -wb; wc = -wc; }
+			if (wa < eps || wb < eps || wc < eps) continue;
+			float y = (wa * a.y + wb * b.y + wc * c.y) / (wa + wb + wc);
+
+			int s = j * nx + i;
+			if (heights[s] != -FLT_MAX && fabs(y - heights[s]) > overhangHeight) overhangs[s] = 1;
+			heights[s] = std::max(heights[s], y);
+		}
+	}
+}
+
+// buildLevels:  recompute the pyramid over the level 0 cells [ci0, ci1] x
+//               [cj0, cj1] and the cells above them
+//
+void Heightfield::buildLevels(int ci0, int cj0, int ci1, int cj1) {
+	for (int cj = cj0; cj <= cj1; cj++) {
+		for (int ci = ci0; ci <= ci1; ci++) {
+			int s = cj * nx + ci;
+			int corners[4] = { s, s + 1, s + nx, s + nx + 1 };
+			float m = -FLT_MAX;
+			for (int k = 0; k < 4; k++) {
+				if (overhangs[corners[k]]) m = FLT_MAX;
+				m = std::max(m, heights[corners[k]]);
+			}
+			levels[0][cj * levelWidth[0] + ci] = m;
+		}
+	}
+	for (int l = 1; l < levels.size(); l++) {
+		ci0 >>= 1; cj0 >>= 1; ci1 >>= 1; cj1 >>= 1;
+		int w = levelWidth[l - 1], h = levelHeight[l - 1];
+		for (int cj = cj0; cj <= cj1; cj++) {
+			for (int ci = ci0; ci <= ci1; ci++) {
+				float m = -FLT_MAX;
+				for (int k = 0; k < 4; k++) {
+					int x = 2 * ci + (k & 1), z = 2 * cj + (k >> 1);
+					if (x < w && z < h) m = std::max(m, levels[l - 1][z * w + x]);
+				}
+				levels[l][cj * levelWidth[l] + ci] = m;
+			}
+		}
+	}
+}
+
+// update:  resample the part of the terrain in [xMin, xMax] x [zMin, zMax]
+//          after its vertices have moved, from the triangles listed in the
+//          blocks around it.  The vertices are assumed to move up or down
+//          only, so that every triangle stays in the blocks it was built in.
+//
+void Heightfield::update(const ofMesh & mesh, float xMin, float zMin, float xMax, float zMax) {
+	if (levels.empty()) return;
+	int i0 = clampi(floorf((xMin - x0) / dx), 0, nx - 1), i1 = clampi(ceilf((xMax - x0) / dx), 0, nx - 1);
+	int j0 = clampi(floorf((zMin - z0) / dz), 0, nz - 1), j1 = clampi(ceilf((zMax - z0) / dz), 0, nz - 1);
+	for (int j = j0; j <= j1; j++) {
+		for (int i = i0; i <= i1; i++) {
+			heights[j * nx + i] = -FLT_MAX;
+			overhangs[j * nx + i] = 0;
+		}
+	}
+
+	// a triangle listed in several blocks is drawn more than once, at the
+	// same heights, which leaves the result unchanged
+	//
+	for (int bz = j0 / blockSize; bz <= j1 / blockSize; bz++) {
+		for (int bx = i0 / blockSize; bx <= i1 / blockSize; bx++) {
+			const vector<int> & faces = blocks[bz * blocksX + bx];
+			for (int f = 0; f < faces.size(); f++) rasterize(mesh, faces[f], i0, j0, i1, j1);
+		}
+	}
+	buildLevels(std::max(i0 - 1, 0), std::max(j0 - 1, 0), std::min(i1, nx - 2), std::min(j1, nz - 2));
+}
+
+// cellCorners:  heights of the four corners of a level 0 cell, in the order
+//               (ci, cj), (ci + 1, cj), (ci, cj + 1), (ci + 1, cj + 1).
+//               Fails if the cell is off the mesh or has an overhang.
+//
+bool Heightfield::cellCorners(int ci, int cj, float h[4]) const {
+	float m = levels[0][cj * levelWidth[0] + ci];
+	if (m == FLT_MAX) return false;
+	int s = cj * nx + ci;
+	h[0] = heights[s];
+	h[1] = heights[s + 1];
+	h[2] = heights[s + nx];
+	h[3] = heights[s + nx + 1];
+	return h[0] != -FLT_MAX && h[1] != -FLT_MAX && h[2] != -FLT_MAX && h[3] != -FLT_MAX;
+}
+
+// height:  terrain height at (x, z), blended from the four samples around
+//          it.  Fails off the mesh and near overhangs.
+//
+bool Heightfield::height(float x, float z, float & h) const {
+	if (levels.empty()) return false;
+	float gx = (x - x0) / dx, gz = (z - z0) / dz;
+	if (!(gx >= 0 && gz >= 0 && gx <= nx - 1 && gz <= nz - 1)) return false;
+	int ci = std::min((int)gx, nx - 2), cj = std::min((int)gz, nz - 2);
+	float c[4];
+	if (!cellCorners(ci, cj, c)) return false;
+	float u = gx - ci, v = gz - cj;
+	h = (c[0] * (1 - u) + c[1] * u) * (1 - v) + (c[2] * (1 - u) + c[3] * u) * v;
+	return true;
+}
+
+// normal:  surface normal of the blended heights at (x, z), for slope checks
+//
+bool Heightfield::normal(float x, float z, ofVec3f & n) const {
+	if (levels.empty()) return false;
+	float gx = (x - x0) / dx, gz = (z - z0) / dz;
+	if (!(gx >= 0 && gz >= 0 && gx <= nx - 1 && gz <= nz - 1)) return false;
+	int ci = std::min((int)gx, nx - 2), cj = std::min((int)gz, nz - 2);
+	float c[4];
+	if (!cellCorners(ci, cj, c)) return false;
+	float u = gx - ci, v = gz - cj;
+	float dhdx = ((c[1] - c[0]) * (1 - v) + (c[3] - c[2]) * v) / dx;
+	float dhdz = ((c[2] - c[0]) * (1 - u) + (c[3] - c[1]) * u) / dz;
+	n = ofVec3f(-dhdx, 1, -dhdz).getNormalized();
+	return true;
+}
+
+// rangeMax:  max over the level 0 cells [ci0, ci1] x [cj0, cj1] below cell
+//            (ci, cj) of "level"; cells that can't raise "best" are skipped
+//
+float Heightfield::rangeMax(int level, int ci, int cj, int ci0, int cj0, int ci1, int cj1, float best) const {
+	float m = levels[level][cj * levelWidth[level] + ci];
+	if (m <= best) return best;
+	int lo_i = ci << level, hi_i = ((ci + 1) << level) - 1;
+	int lo_j = cj << level, hi_j = ((cj + 1) << level) - 1;
+	if (hi_i < ci0 || lo_i > ci1 || hi_j < cj0 || lo_j > cj1) return best;
+	if (level == 0 || (lo_i >= ci0 && hi_i <= ci1 && lo_j >= cj0 && hi_j <= cj1)) return m;
+	int w = levelWidth[level - 1], h = levelHeight[level - 1];
+	for (int k = 0; k < 4; k++) {
+		int x = 2 * ci + (k & 1), z = 2 * cj + (k >> 1);
+		if (x < w && z < h) best = rangeMax(level - 1, x, z, ci0, cj0, ci1, cj1, best);
+	}
+	return best;
+}
+
+// maxHeight:  highest terrain point under the xz footprint of "box", to the
+//             resolution of the grid cells (-FLT_MAX if there is no terrain
+//             there).  Ground contact is topRtn >= box.min().y().  Fails if
+//             the footprint has an overhang.
+//
+bool Heightfield::maxHeight(const Box & box, float & topRtn) const {
+	topRtn = -FLT_MAX;
+	if (levels.empty()) return true;
+	int w = nx - 1, h = nz - 1;
+	int ci0 = floorf((box.min().x() - x0) / dx), ci1 = floorf((box.max().x() - x0) / dx);
+	int cj0 = floorf((box.min().z() - z0) / dz), cj1 = floorf((box.max().z() - z0) / dz);
+	if (ci1 < 0 || cj1 < 0 || ci0 >= w || cj0 >= h) return true;
+	ci0 = std::max(ci0, 0); cj0 = std::max(cj0, 0);
+	ci1 = std::min(ci1, w - 1); cj1 = std::min(cj1, h - 1);
+	int top = levels.size() - 1;
+	topRtn = rangeMax(top, 0, 0, ci0, cj0, ci1, cj1, -FLT_MAX);
+	return topRtn != FLT_MAX;
+}
+
+// intersect:  first hit of "ray" with the blended surface before tMax.  The
+//             march starts at the top of the pyramid; it steps over a cell
+//             whose max is below the ray across it, and moves up a level
+//             after each step, or else moves down into the cell.  A level 0
+//             cell is intersected exactly (the height along the ray is a
+//             quadratic in t).
+//
+//             Returns false on a miss.  hit.node is the level 0 cell of the
+//             hit; when the march stops at an overhang it returns false with
+//             hit.node set to that cell, and the ray should go to the Octree.
+//
+bool Heightfield::intersect(const Ray & ray, RayHit & hit, float tMax) const {
+	hit = RayHit();
+	if (levels.empty()) return false;
+	float ox = ray.origin.x(), oy = ray.origin.y(), oz = ray.origin.z();
+	float rdx = ray.direction.x(), rdy = ray.direction.y(), rdz = ray.direction.z();
+
+	// straight down (or up): a single lookup
+	//
+	if (fabs(rdx) < 1e-7f && fabs(rdz) < 1e-7f) {
+		float h;
+		if (!height(ox, oz, h)) {
+			float gx = (ox - x0) / dx, gz = (oz - z0) / dz;
+			if (gx >= 0 && gz >= 0 && gx <= nx - 1 && gz <= nz - 1)
+				hit.node = std::min((int)gz, nz - 2) * levelWidth[0] + std::min((int)gx, nx - 2);
+			return false;
+		}
+		float t = (h - oy) / rdy;
+		if (rdy == 0 || t < 0 || t > tMax) return false;
+		hit.t = t;
+		hit.point = Vector3(ox, h, oz);
+		hit.node = std::min((int)((oz - z0) / dz), nz - 2) * levelWidth[0] + std::min((int)((ox - x0) / dx), nx - 2);
+		return true;
+	}
+
+	// ray in grid units, clipped to the grid and to below the highest point
+	//
+	float gox = (ox - x0) / dx, goz = (oz - z0) / dz;
+	float gdx = rdx / dx, gdz = rdz / dz;
+	float t0 = 0, t1 = tMax;
+	float lim[2][2] = { { gox, gdx }, { goz, gdz } };
+	float ext[2] = { (float)(nx - 1), (float)(nz - 1) };
+	for (int a = 0; a < 2; a++) {
+		float o = lim[a][0], d = lim[a][1];
+		if (fabs(d) < 1e-12f) {
+			if (o < 0 || o > ext[a]) return false;
+			continue;
+		}
+		float ta = (0 - o) / d, tb = (ext[a] - o) / d;
+		t0 = std::max(t0, std::min(ta, tb));
+		t1 = std::min(t1, std::max(ta, tb));
+	}
+	float top = levels.back()[0];
+	if (top == -FLT_MAX) return false;
+	if (top != FLT_MAX) {
+		if (rdy < 0) t0 = std::max(t0, (top - oy) / rdy);
+		else if (oy > top) return false;
+	}
+	if (t0 > t1) return false;
+
+	// a point on a cell boundary is nudged this far along the ray (in
+	// cells) to pick the cell being entered
+	//
+	const float nudge = 1e-4f;
+	float bx = gdx > 0 ? nudge : gdx < 0 ? -nudge : 0;
+	float bz = gdz > 0 ? nudge : gdz < 0 ? -nudge : 0;
+	float minStep = nudge / std::max(fabs(gdx), fabs(gdz));
+
+	int level = levels.size() - 1;
+	float t = t0;
+	while (t < t1) {
+		int ci = clampi((int)floorf(gox + gdx * t + bx) >> level, 0, levelWidth[level] - 1);
+		int cj = clampi((int)floorf(goz + gdz * t + bz) >> level, 0, levelHeight[level] - 1);
+
+		// where the ray leaves this cell
+		float tExit = t1;
+		if (gdx > 0) tExit = std::min(tExit, (((ci + 1) << level) - gox) / gdx);
+		else if (gdx < 0) tExit = std::min(tExit, ((ci << level) - gox) / gdx);
+		if (gdz > 0) tExit = std::min(tExit, (((cj + 1) << level) - goz) / gdz);
+		else if (gdz < 0) tExit = std::min(tExit, ((cj << level) - goz) / gdz);
+		if (tExit <= t) tExit = std::min(t + minStep, t1);
+
+		float m = levels[level][cj * levelWidth[level] + ci];
+		float rayLow = std::min(oy + rdy * t, oy + rdy * tExit);
+		if (rayLow > m) {
+			t = tExit;
+			if (level < levels.size() - 1) level++;
+			continue;
+		}
+		if (level > 0) {
+			level--;
+			continue;
+		}
+
+		float c[4];
+		if (!cellCorners(ci, cj, c)) {
+			if (m == FLT_MAX) {
+				hit.node = cj * levelWidth[0] + ci;
+				return false;
+			}
+			t = tExit;
+			continue;
+		}
+
+		// y(s) - h(s) along the ray from s = 0 at t is A s^2 + B s + C,
+		// with the bilinear patch h = a + b u + c v + d u v
+		//
+		float u0 = gox + gdx * t - ci, v0 = goz + gdz * t - cj;
+		float pa = c[0], pb = c[1] - c[0], pc = c[2] - c[0], pd = c[0] - c[1] - c[2] + c[3];
+		float A = -pd * gdx * gdz;
+		float B = rdy - (pb * gdx + pc * gdz + pd * (u0 * gdz + v0 * gdx));
+		float C = oy + rdy * t - (pa + pb * u0 + pc * v0 + pd * u0 * v0);
+		float s1 = tExit - t;
+		float s = -1;
+		if (C <= 0) s = 0;
+		else if (fabs(A) < 1e-12f) {
+			if (B < 0) s = -C / B;
+		}
+		else {
+			float disc = B * B - 4 * A * C;
+			if (disc >= 0) {
+				float q = -0.5f * (B + (B < 0 ? -sqrtf(disc) : sqrtf(disc)));
+				float r0 = q / A, r1 = q != 0 ? C / q : -1;
+				if (r0 > r1) std::swap(r0, r1);
+				s = r0 >= 0 ? r0 : r1;
+			}
+		}
+		if (s >= 0 && s <= s1) {
+			hit.t = t + s;
+			hit.u = ofClamp(u0 + gdx * s, 0, 1);
+			hit.v = ofClamp(v0 + gdz * s, 0, 1);
+			hit.node = cj * levelWidth[0] + ci;
+			hit.point = ray.origin + ray.direction * hit.t;
+			return true;
+		}
+		t = tExit;
+		if (level < levels.size() - 1) level++;
+	}
+	return false;
+}
+
+size_t Heightfield::memoryUsage() const {
+	size_t bytes = heights.size() * sizeof(float) + overhangs.size();
+	for (int l = 0; l < levels.size(); l++) bytes += levels[l].size() * sizeof(float);
+	for (int b = 0; b < blocks.size(); b++) bytes += blocks[b].size() * sizeof(int) + sizeof(vector<int>);
+	return bytes;
+}
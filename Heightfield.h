@@ -0,0 +1,53 @@
+//--------------------------------------------------------------
+//
+//  Heightfield:  regular grid of terrain heights sampled from a mesh, with a
+//  pyramid of maximum heights (a max-mipmap) over its cells.  A height
+//  lookup is a bilinear blend of four samples, and a ray marches down the
+//  pyramid, stepping over every region whose highest point is below it.
+//
+//  The terrain is 2.5D almost everywhere; grid points where the mesh has
+//  more than one surface (overhangs) are flagged, and queries that reach
+//  them fail so that the caller can ask the Octree instead.
+//
+#pragma once
+#include "SpatialIndex.h"
+
+class Heightfield {
+public:
+	void build(const ofMesh & mesh, int resolution = 0);
+	void update(const ofMesh & mesh, float xMin, float zMin, float xMax, float zMax);
+	bool height(float x, float z, float & h) const;
+	bool normal(float x, float z, ofVec3f & n) const;
+	bool maxHeight(const Box & box, float & topRtn) const;
+	bool intersect(const Ray & ray, RayHit & hit, float tMax = FLT_MAX) const;
+	size_t memoryUsage() const;
+
+	void rasterize(const ofMesh & mesh, int face, int i0, int j0, int i1, int j1);
+	void buildLevels(int ci0, int cj0, int ci1, int cj1);
+	float rangeMax(int level, int ci, int cj, int ci0, int cj0, int ci1, int cj1, float best) const;
+	bool cellCorners(int ci, int cj, float h[4]) const;
+
+	// samples are nx * nz grid points, dx and dz apart from (x0, z0);
+	// cells are the (nx - 1) * (nz - 1) squares between them
+	//
+	int nx = 0, nz = 0;
+	float x0 = 0, z0 = 0, dx = 1, dz = 1;
+	vector<float> heights;			// -FLT_MAX where no triangle covers a sample
+	vector<unsigned char> overhangs;	// samples covered by surfaces at different heights
+
+	// levels[0] holds the highest corner of every cell (FLT_MAX for a cell
+	// with an overhang corner); each level above holds the max of 2x2
+	// cells of the one below, up to a single cell for the whole terrain
+	//
+	vector<vector<float>> levels;
+	vector<int> levelWidth, levelHeight;
+
+	// triangles listed per square block of samples, to find the ones to
+	// resample when part of the terrain is deformed by update()
+	//
+	vector<vector<int>> blocks;
+	int blockSize = 16;
+	int blocksX = 0, blocksZ = 0;
+
+	float overhangHeight = 0;	// surfaces further apart than this at a sample are an overhang (0: auto)
+};
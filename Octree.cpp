@@ -11,7 +11,141 @@
 
 
 #include "Octree.h"
+#include "OctreeSimd.h"
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <float.h>
+#include <queue>
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
  
+// size of the explicit traversal stack used by the flat queries; each level
+// pushes at most 8 children, so this covers trees well past 20 levels.
+//
+static const int MaxStack = 8 * 64;
+
+// per-thread query counters (see OctreeStats).  The STATS_ macros compile to
+// nothing when OCTREE_STATS is 0.
+//
+static thread_local OctreeStats threadStats;
+
+#if OCTREE_STATS
+static inline void statsStack(int depth) {
+	OctreeStats & s = threadStats;
+	if (depth > s.queryDepth) {
+		s.stackDepthSum += depth - s.queryDepth;
+		s.queryDepth = depth;
+		if (depth > s.maxStackDepth) s.maxStackDepth = depth;
+	}
+}
+#define STATS_QUERY()	(threadStats.queries++, threadStats.queryDepth = 0)
+#define STATS_NODE()	(threadStats.nodesVisited++)
+#define STATS_BOXES(n)	(threadStats.boxTests += (n))
+#define STATS_LEAF()	(threadStats.leavesReached++)
+#define STATS_STACK(n)	statsStack(n)
+#else
+#define STATS_QUERY()	((void)0)
+#define STATS_NODE()	((void)0)
+#define STATS_BOXES(n)	((void)0)
+#define STATS_LEAF()	((void)0)
+#define STATS_STACK(n)	((void)0)
+#endif
+
+// the state of a lazy octree (see Octree::bLazy): the cell of each pending
+// node (its subDivideBox8() box, which a face octree's refit box is not),
+// the depth they are all at, and the lock.  Queries read the tree under the
+// shared lock; nodes are expanded under the exclusive one.
+//
+class LazyNodes {
+public:
+	vector<Box> cells;
+	int depth = 0;				// of the pending nodes, the root is 0
+	atomic<int> pending{ 0 };	// nodes not expanded yet
+	shared_mutex lock;
+};
+
+// pendingNodes:  the pending nodes a query would reach going down through
+//                the node boxes that pass "reaches".  They are all at
+//                lazy->depth, so the search stops there.  A query that
+//                takes nodes at maxDepth as leaves doesn't look inside the
+//                pending nodes there or below.
+//
+template <class Reaches>
+static void pendingNodes(const Octree & tree, Reaches reaches, int maxDepth, vector<int> & nodesRtn) {
+	if (tree.numNodes == 0 || !reaches(tree.nodeData[0].box)) return;
+	int stack[MaxStack];
+	int stackDepth[MaxStack];
+	int top = 0;
+	stack[top] = 0;
+	stackDepth[top++] = 0;
+	while (top > 0) {
+		top--;
+		const FlatNode & node = tree.nodeData[stack[top]];
+		int depth = stackDepth[top];
+		if (depth >= maxDepth) continue;
+		if (node.isPending()) {
+			nodesRtn.push_back(stack[top]);
+			continue;
+		}
+		if (node.isLeaf() || depth >= tree.lazy->depth) continue;
+		for (int k = 0; k < node.numChildren(); k++) {
+			if (!reaches(tree.nodeData[node.firstChild + k].box)) continue;
+			stack[top] = node.firstChild + k;
+			stackDepth[top++] = depth + 1;
+		}
+	}
+}
+
+// LazyLock:  taken by every query.  On a lazy octree it first expands the
+//            pending nodes the query would reach ("reaches" tests a node
+//            box) above its maxDepth, then holds the shared lock until the
+//            query returns.  A query run by another query of the same tree
+//            (getPointsInBox() runs intersect()) is covered by the outer
+//            one's lock.
+//
+static thread_local const Octree *lockedTree = nullptr;
+
+class LazyLock {
+public:
+	LazyLock(const Octree & tree) : LazyLock(tree, [](const Box &) { return false; }) {}
+
+	template <class Reaches>
+	LazyLock(const Octree & tree, Reaches reaches, int maxDepth = INT_MAX) {
+		if (!tree.lazy || lockedTree == &tree || tree.lazy->pending.load(memory_order_acquire) == 0) return;
+		lazy = tree.lazy.get();
+		static thread_local vector<int> found;
+		for (;;) {
+			lazy->lock.lock_shared();
+			found.clear();
+			pendingNodes(tree, reaches, maxDepth, found);
+			if (found.empty()) break;
+			lazy->lock.unlock_shared();
+			tree.expand(found);
+		}
+		lockedTree = &tree;
+	}
+
+	~LazyLock() {
+		if (!lazy) return;
+		lockedTree = nullptr;
+		lazy->lock.unlock_shared();
+	}
+
+	LazyNodes *lazy = nullptr;
+};
 
 
 //draw a box from a "Box" class  
@@ -30,13 +164,13 @@ void Octree::drawBox(const Box &box) {
 
 // return a Mesh Bounding Box for the entire Mesh
 //
-Box Octree::meshBounds(const ofMesh & mesh) {
-	int n = mesh.getNumVertices();
-	ofVec3f v = mesh.getVertex(0);
+Box Octree::meshBounds(const MeshView & mesh) {
+	int n = mesh.numVertices;
+	ofVec3f v = mesh.vertex(0);
 	ofVec3f max = v;
 	ofVec3f min = v;
 	for (int i = 1; i < n; i++) {
-		ofVec3f v = mesh.getVertex(i);
+		ofVec3f v = mesh.vertex(i);
 
 		if (v.x > max.x) max.x = v.x;
 		else if (v.x < min.x) min.x = v.x;
@@ -55,12 +189,12 @@ Box Octree::meshBounds(const ofMesh & mesh) {
 // getMeshPointsInBox:  return an array of indices to points in mesh that are contained 
 //                      inside the Box.  Return count of points found;
 //
-int Octree::getMeshPointsInBox(const ofMesh & mesh, const vector<int>& points,
+int Octree::getMeshPointsInBox(const MeshView & mesh, const vector<int>& points,
 	Box & box, vector<int> & pointsRtn)
 {
 	int count = 0;
 	for (int i = 0; i < points.size(); i++) {
-		ofVec3f v = mesh.getVertex(points[i]);
+		ofVec3f v = mesh.vertex(points[i]);
 		if (box.inside(Vector3(v.x, v.y, v.z))) {
 			count++;
 			pointsRtn.push_back(points[i]);
@@ -72,21 +206,17 @@ int Octree::getMeshPointsInBox(const ofMesh & mesh, const vector<int>& points,
 // getMeshFacesInBox:  return an array of indices to Faces in mesh that are contained 
 //                      inside the Box.  Return count of faces found;
 //
-int Octree::getMeshFacesInBox(const ofMesh & mesh, const vector<int>& faces,
+int Octree::getMeshFacesInBox(const MeshView & mesh, const vector<int>& faces,
 	Box & box, vector<int> & facesRtn)
 {
 	int count = 0;
 	for (int i = 0; i < faces.size(); i++) {
-		ofMeshFace face = mesh.getFace(faces[i]);
-		ofVec3f v[3];
-		v[0] = face.getVertex(0);
-		v[1] = face.getVertex(1);
-		v[2] = face.getVertex(2);
 		Vector3 p[3];
-		p[0] = Vector3(v[0].x, v[0].y, v[0].z);
-		p[1] = Vector3(v[1].x, v[1].y, v[1].z);
-		p[2] = Vector3(v[2].x, v[2].y, v[2].z);
-		if (box.inside(p,3)) {
+		for (int k = 0; k < 3; k++) {
+			ofVec3f v = mesh.vertex(mesh.faceVertex(faces[i], k));
+			p[k] = Vector3(v.x, v.y, v.z);
+		}
+		if (box.inside(p, 3)) {
 			count++;
 			facesRtn.push_back(faces[i]);
 		}
@@ -96,7 +226,13 @@ int Octree::getMeshFacesInBox(const ofMesh & mesh, const vector<int>& faces,
 
 //  Subdivide a Box into eight(8) equal size boxes, return them in boxList;
 //
-void Octree::subDivideBox8(const Box &box, vector<Box> & boxList) {
+void Octree::subDivideBox8(const Box &box, vector<Box> & boxList) const {
+	Box b[8];
+	subDivideBox8(box, b);
+	boxList.assign(b, b + 8);
+}
+
+void Octree::subDivideBox8(const Box &box, Box b[8]) const {
 	Vector3 min = box.parameters[0];
 	Vector3 max = box.parameters[1];
 	Vector3 size = max - min;
@@ -108,50 +244,125 @@ void Octree::subDivideBox8(const Box &box, vector<Box> & boxList) {
 
 	//  generate ground floor
 	//
-	Box b[8];
 	b[0] = Box(min, center);
 	b[1] = Box(b[0].min() + Vector3(xdist, 0, 0), b[0].max() + Vector3(xdist, 0, 0));
 	b[2] = Box(b[1].min() + Vector3(0, 0, zdist), b[1].max() + Vector3(0, 0, zdist));
 	b[3] = Box(b[2].min() + Vector3(-xdist, 0, 0), b[2].max() + Vector3(-xdist, 0, 0));
 
-	boxList.clear();
-	for (int i = 0; i < 4; i++)
-		boxList.push_back(b[i]);
-
 	// generate second story
 	//
 	for (int i = 4; i < 8; i++) {
 		b[i] = Box(b[i - 4].min() + h, b[i - 4].max() + h);
-		boxList.push_back(b[i]);
 	}
 }
 
-void Octree::create(const ofMesh & geo, int numLevels) {
+// create:  build the octree on a copy of "geo", or on the arrays of a
+//         MeshView without copying them
+//
+void Octree::create(const ofMesh & geo, int numLevels, int numThreads) {
+	mesh = geo;
+	create(MeshView(mesh), numLevels, numThreads);
+}
+
+void Octree::create(const MeshView & geo, int numLevels, int numThreads) {
 	float timeToBuild = ofGetElapsedTimeMillis();
 	// initialize octree structure
 	//
-	mesh = geo;
+	setMesh(geo);
+	levels = numLevels;
+	bUpdatesReady = false;
+	deadNodes = deadPoints = 0;
 	int level = 0;
-	root.box = meshBounds(mesh);
-	if (!bUseFaces) {
-		for (int i = 0; i < mesh.getNumVertices(); i++) {
-			root.points.push_back(i);
-		}
-	}
-	else {
-		// need to load face vertices here
-		//
-	}
+	root = TreeNode();
+	numLeaf = 0;
+	root.box = meshBounds(view);
+	Box rootCell = root.box;
+	lazy.reset();
+	points.resize(bUseFaces ? view.numFaces() : view.numVertices);
+	for (int i = 0; i < points.size(); i++) points[i] = i;
+	loadBuildCoords(0, points.size());
+	root.end = points.size();
 
-	// recursively buid octree
+	// recursively buid octree; a lazy one only to the prebuilt levels
 	//
 	level++;
-    subdivide(mesh, root, numLevels, level);
+	int buildLevels = bLazy ? std::min(numLevels, prebuiltLevels + 1) : numLevels;
+	if (buildMethod == BuildMorton && !bLazy && !bUseFaces && maxLeafPoints == 1 && minCellSize == 0)
+		buildMorton(numLevels);
+	else if (numThreads > 1)
+		subdivideParallel(buildLevels, level, numThreads);
+	else
+		subdivide(root, buildLevels, level);
+	freeBuildCoords();
+	if (bUseFaces) {
+		refitFaceBoxes(root);
+		loadFaceData();
+	}
+	if (!bKeepInteriorPoints) dropInteriorPoints(root);
+
+	// pack the tree into the flat node array used by the queries
+	//
+	flatten();
+	if (bLazy) markPending(rootCell);
+	bindArrays();
+	if (!bKeepTree) vector<TreeNode>().swap(root.children);
 
 	//time to build octree
-	cout << "Time to build octree: " << ofGetElapsedTimeMillis() - timeToBuild << "ms" << endl;
+	cout << "Time to build octree: " << ofGetElapsedTimeMillis() - timeToBuild << "ms";
+	if (numThreads > 1) cout << " (" << numThreads << " threads)";
+	if (lazy) cout << " (" << numPending() << " cells pending)";
+	cout << endl;
+	cout << "Octree memory: " << memoryUsage() / 1024 << "KB, mesh " << meshMemoryUsage() / 1024 << "KB" << endl;
+}
+
+
+// setMesh:  read the mesh through "geo" from now on.  The octree's copy is
+//           dropped unless "geo" is a view of it; with bPackVertices the
+//           positions are copied to "packed" and read from there.
+//
+void Octree::setMesh(const MeshView & geo) {
+	if (geo.vertices == nullptr || geo.vertices != (const float *)mesh.getVerticesPointer()) mesh = ofMesh();
+	view = geo;
+	packed.clear();
+	if (bPackVertices) {
+		packed.resize(3 * (size_t)geo.numVertices);
+		for (int i = 0; i < geo.numVertices; i++) {
+			ofVec3f v = geo.vertex(i);
+			packed[3 * i] = v.x;
+			packed[3 * i + 1] = v.y;
+			packed[3 * i + 2] = v.z;
+		}
+		view.vertices = packed.data();
+		view.stride = 3;
+	}
+}
+
+// setVertex:  move vertex i of the octree's own positions (the mesh copy
+//             and/or "packed").  Returns false when the octree has none, i.e.
+//             it reads the caller's arrays.
+//
+bool Octree::setVertex(int i, const ofVec3f & p) {
+	bool own = false;
+	if (!packed.empty()) {
+		packed[3 * i] = p.x;
+		packed[3 * i + 1] = p.y;
+		packed[3 * i + 2] = p.z;
+		own = true;
+	}
+	if (mesh.getNumVertices() > 0) {
+		mesh.setVertex(i, p);
+		own = true;
+	}
+	return own;
 }
 
+// build:  SpatialIndex entry point.  The level limit is that of the last
+//         create() or load(), 20 if there was none; with a leaf capacity
+//         above 1 it is only a safety limit.
+//
+void Octree::build(const ofMesh & geo, int numThreads) {
+	create(geo, levels > 0 ? levels : 20, numThreads);
+}
 
 //
 // subdivide:  recursive function to perform octree subdivision on a mesh
@@ -167,43 +378,797 @@ void Octree::create(const ofMesh & geo, int numLevels) {
 //         
 //      
              
-void Octree::subdivide(const ofMesh & mesh, TreeNode & node, int numLevels, int level) {
-	if (level >= numLevels) return;
+void Octree::subdivide(TreeNode & node, int numLevels, int level) const {
+	subdivide(node, numLevels, level, numLeaf);
+}
+
+void Octree::subdivide(TreeNode & node, int numLevels, int level, int & leafCount) const {
+	if (!canSplit(node.box, level, numLevels)) {
+		leafCount++;		// a leaf over capacity at the level limit
+		return;
+	}
+
+	leafCount += splitNode(node);
+	for (int i = 0; i < node.children.size(); i++) {
+		if (node.children[i].numPoints() > leafCapacity())
+			subdivide(node.children[i], numLevels, level + 1, leafCount);
+	}
+}
 
-	// subdvide algorithm implemented here
-	vector<Box> tempBox;
+// canSplit:  the build policy.  A node at "level" (the root is level 1) that
+//            holds more than leafCapacity() points is split unless it is at
+//            the level limit or its children would be smaller than
+//            minCellSize on every side.  With a leaf capacity above 1 the
+//            depth follows the local vertex density and numLevels is only a
+//            safety limit.
+//
+bool Octree::canSplit(const Box & box, int level, int numLevels) const {
+	if (level >= numLevels) return false;
+	if (minCellSize <= 0) return true;
+	Vector3 size = box.max() - box.min();
+	float side = std::max(size.x(), std::max(size.y(), size.z()));
+	return side / 2 >= minCellSize;
+}
+
+// splitNode:  sort the points of "node" into its eight child boxes and add a
+//             child for every box that holds at least one point.  Children are
+//             added in subDivideBox8() order and get the matching sub-run of
+//             the node's points.  Returns the number of children that are
+//             leaves (no more than leafCapacity() points).
+//
+int Octree::splitNode(TreeNode & node) const {
+	Box tempBox[8];
 	subDivideBox8(node.box, tempBox);
-	
-	for (int i = 0; i < tempBox.size(); i++) {
-		vector<int> pointsRtn;
-		getMeshPointsInBox(mesh, node.points, tempBox[i], pointsRtn);
-		if (pointsRtn.size() > 0) {
-			TreeNode& t = TreeNode();
+	int split[9];
+	partitionPoints(node.box.center(), node.begin, node.end, split);
+
+	int count = 0;
+	for (int i = 0; i < 8; i++)
+		if (split[i + 1] > split[i]) count++;
+
+	int leaves = 0;
+	node.children.reserve(count);
+	for (int i = 0; i < 8; i++) {
+		if (split[i + 1] > split[i]) {
+			node.children.push_back(TreeNode());
+			TreeNode & t = node.children.back();
 			t.box = tempBox[i];
-			t.points = pointsRtn;
-			node.children.push_back(t);
-			if (pointsRtn.size() > 1) {
-				subdivide(mesh, node.children.back(), numLevels, level);
-				level++;
+			t.begin = split[i];
+			t.end = split[i + 1];
+			t.octant = i;
+			if (t.numPoints() <= leafCapacity()) leaves++;
+		}
+	}
+	return leaves;
+}
+
+// subDivideBox8() box index for each octant, where bit 0/1/2 of the octant
+// selects the upper half in x/y/z
+//
+static const int octantBox[8] = { 0, 1, 4, 5, 3, 2, 7, 6 };
+
+// partitionPoints:  reorder points[begin, end) so that the points of each
+//                   subDivideBox8() box are contiguous; box i gets
+//                   [split[i], split[i + 1]).  One pass classifies every
+//                   point into its octant (classifyOctants, from the SoA
+//                   buildCoords) and a counting sort scatters the run and its
+//                   coordinates into place, keeping the points' order within
+//                   each box.  A point on a split plane goes to the upper side.
+//
+void Octree::partitionPoints(const Vector3 & c, int begin, int end, int split[9]) const {
+	int n = end - begin;
+	int s = begin - scratchBase;		// the run's first entry in the build scratch
+	float center[3] = { c.x(), c.y(), c.z() };
+	int count[8] = { 0 };
+	unsigned char *oct = octants.data() + s;
+	classifyOctants(buildCoords[0].data() + s, buildCoords[1].data() + s, buildCoords[2].data() + s,
+		n, center, oct, count);
+
+	int boxCount[8], next[8];
+	for (int o = 0; o < 8; o++) boxCount[octantBox[o]] = count[o];
+	split[0] = begin;
+	for (int i = 0; i < 8; i++) split[i + 1] = split[i] + boxCount[i];
+	for (int o = 0; o < 8; o++) next[o] = split[octantBox[o]] - scratchBase;
+	for (int i = 0; i < n; i++) {
+		int d = next[oct[i]]++;
+		scatterPoints[d] = points[begin + i];
+		for (int a = 0; a < 3; a++) scatterCoords[a][d] = buildCoords[a][s + i];
+	}
+	std::copy(scatterPoints.begin() + s, scatterPoints.begin() + s + n, points.begin() + begin);
+	for (int a = 0; a < 3; a++)
+		std::copy(scatterCoords[a].begin() + s, scatterCoords[a].begin() + s + n, buildCoords[a].begin() + s);
+}
+
+// loadBuildCoords:  fill the build scratch for the run points[begin, end)
+//                   with the position each point is sorted by: the vertex,
+//                   or a face's centroid (a face goes to the child that
+//                   holds its centroid)
+//
+void Octree::loadBuildCoords(int begin, int end) const {
+	int n = end - begin;
+	scratchBase = begin;
+	for (int a = 0; a < 3; a++) {
+		buildCoords[a].resize(n);
+		scatterCoords[a].resize(n);
+	}
+	scatterPoints.resize(n);
+	octants.resize(n);
+	for (int k = 0; k < n; k++) {
+		int i = points[begin + k];
+		ofVec3f p = !bUseFaces ? view.vertex(i) : (view.vertex(view.faceVertex(i, 0)) +
+			view.vertex(view.faceVertex(i, 1)) + view.vertex(view.faceVertex(i, 2))) / 3;
+		buildCoords[0][k] = p.x;
+		buildCoords[1][k] = p.y;
+		buildCoords[2][k] = p.z;
+	}
+}
+
+void Octree::freeBuildCoords() const {
+	for (int a = 0; a < 3; a++) {
+		vector<float>().swap(buildCoords[a]);
+		vector<float>().swap(scatterCoords[a]);
+	}
+	vector<int>().swap(scatterPoints);
+	vector<unsigned char>().swap(octants);
+	scratchBase = 0;
+}
+
+// refitFaceBoxes:  a face is stored in the node that holds its centroid but
+//                  may stick out of it, so grow every node box to bound its
+//                  faces (leaves) or its children (interior nodes).
+//
+void Octree::refitFaceBoxes(TreeNode & node) const {
+	ofVec3f lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	auto grow = [&](const Vector3 & a, const Vector3 & b) {
+		lo.x = std::min(lo.x, a.x()); lo.y = std::min(lo.y, a.y()); lo.z = std::min(lo.z, a.z());
+		hi.x = std::max(hi.x, b.x()); hi.y = std::max(hi.y, b.y()); hi.z = std::max(hi.z, b.z());
+	};
+	if (node.children.empty()) {
+		for (int i = node.begin; i < node.end; i++) {
+			for (int k = 0; k < 3; k++) {
+				ofVec3f v = view.vertex(view.faceVertex(points[i], k));
+				grow(Vector3(v.x, v.y, v.z), Vector3(v.x, v.y, v.z));
 			}
-			else {
+		}
+	}
+	for (int i = 0; i < node.children.size(); i++) {
+		refitFaceBoxes(node.children[i]);
+		grow(node.children[i].box.min(), node.children[i].box.max());
+	}
+	node.box = Box(Vector3(lo.x, lo.y, lo.z), Vector3(hi.x, hi.y, hi.z));
+}
+
+// loadFaceData:  copy the triangles into faceData in "points" order so that a
+//                leaf's triangles are contiguous for the SIMD kernel.  Three
+//                empty triangles at the end keep 4-wide loads in bounds.
+//
+void Octree::loadFaceData() {
+	int n = points.size();
+	for (int k = 0; k < 9; k++) faceData[k].assign(n + 3, 0.0f);
+	for (int i = 0; i < n; i++)
+		loadFace(i);
+}
+
+void Octree::loadFace(int i) const {
+	ofVec3f v0 = view.vertex(view.faceVertex(points[i], 0));
+	ofVec3f e1 = view.vertex(view.faceVertex(points[i], 1)) - v0;
+	ofVec3f e2 = view.vertex(view.faceVertex(points[i], 2)) - v0;
+	faceData[0][i] = v0.x; faceData[1][i] = v0.y; faceData[2][i] = v0.z;
+	faceData[3][i] = e1.x; faceData[4][i] = e1.y; faceData[5][i] = e1.z;
+	faceData[6][i] = e2.x; faceData[7][i] = e2.y; faceData[8][i] = e2.z;
+}
+
+// dropInteriorPoints:  clear the point runs of all interior nodes so that only
+//                      leaves refer to points.
+//
+void Octree::dropInteriorPoints(TreeNode & node) const {
+	if (node.children.empty()) return;
+	node.begin = node.end = 0;
+	for (int i = 0; i < node.children.size(); i++)
+		dropInteriorPoints(node.children[i]);
+}
+
+// memoryUsage:  bytes used by the tree nodes, the flat node array and the
+//               point index buffer.
+//
+static size_t treeBytes(const TreeNode & node) {
+	size_t bytes = node.children.capacity() * sizeof(TreeNode);
+	for (int i = 0; i < node.children.size(); i++)
+		bytes += treeBytes(node.children[i]);
+	return bytes;
+}
+
+size_t Octree::memoryUsage() const {
+	return sizeof(TreeNode) + treeBytes(root) + nodes.capacity() * sizeof(FlatNode) +
+		childBounds.capacity() * sizeof(ChildBounds) +
+		points.capacity() * sizeof(int) + faceData[0].capacity() * sizeof(float) * 9;
+}
+
+// meshMemoryUsage:  bytes of the octree's own copy of the mesh (none when it
+//                   reads the caller's arrays)
+//
+size_t Octree::meshMemoryUsage() const {
+	return packed.capacity() * sizeof(float) + mesh.getNumVertices() * sizeof(ofDefaultVertexType) +
+		mesh.getNumNormals() * sizeof(ofDefaultNormalType) + mesh.getNumTexCoords() * sizeof(ofDefaultTexCoordType) +
+		mesh.getNumColors() * sizeof(ofFloatColor) + mesh.getNumIndices() * sizeof(ofIndexType);
+}
+
+OctreeStats & Octree::stats() {
+	return threadStats;
+}
+
+void Octree::resetStats() {
+	threadStats = OctreeStats();
+}
+
+// print the counters as totals and averages per query
+//
+void OctreeStats::print() const {
+	double n = queries ? queries : 1;
+	cout << "queries: " << queries << " nodes visited: " << nodesVisited << " (" << nodesVisited / n << "/query)"
+		<< " box tests: " << boxTests << " (" << boxTests / n << "/query)"
+		<< " leaves: " << leavesReached << " (" << leavesReached / n << "/query)"
+		<< " stack depth: " << stackDepthSum / n << " avg " << maxStackDepth << " max" << endl;
+}
+
+// printReport:  shape of the flat tree and what it costs: nodes per level, a
+//               histogram of points (faces) per leaf in power-of-two bins,
+//               and the bytes of the node boxes, child bounds and point lists.
+//               Works on a built or a loaded (mapped) tree.
+//
+void Octree::printReport() const {
+	if (numNodes == 0) {
+		cout << "Octree: empty" << endl;
+		return;
+	}
+
+	// nodes are stored breadth first, so a node's depth is known before its
+	// children are reached
+	//
+	vector<int> depth(numNodes, 0);
+	vector<int> perLevel;
+	int leaves = 0, interior = 0, numPoints = 0;
+	int histogram[9] = {};			// 0, 1, 2, 3-4, 5-8, 9-16, 17-32, 33-64, >64
+	for (int i = 0; i < numNodes; i++) {
+		const FlatNode & node = nodeData[i];
+		if (depth[i] >= perLevel.size()) perLevel.resize(depth[i] + 1, 0);
+		perLevel[depth[i]]++;
+		numPoints = std::max(numPoints, node.end);
+		if (!node.isLeaf()) {
+			interior++;
+			for (int k = 0; k < node.numChildren(); k++)
+				depth[node.firstChild + k] = depth[i] + 1;
+			continue;
+		}
+		leaves++;
+		int n = node.numPoints();
+		int bin = 0;
+		while (bin < 8 && n > (bin ? 1 << (bin - 1) : 0)) bin++;
+		histogram[bin]++;
+	}
+
+	cout << "Octree: " << numNodes << " nodes, " << leaves << " leaves, " << perLevel.size() << " levels, "
+		<< numPoints << (bUseFaces ? " faces" : " points") << endl;
+	if (lazy) cout << "lazy: " << lazy->cells.size() - numPending() << " of " << lazy->cells.size()
+		<< " cells expanded (at depth " << lazy->depth << ")" << endl;
+	cout << "nodes per level:";
+	for (int l = 0; l < perLevel.size(); l++) cout << " " << perLevel[l];
+	cout << endl;
+	const char *bins[9] = { "0", "1", "2", "3-4", "5-8", "9-16", "17-32", "33-64", ">64" };
+	cout << "leaf occupancy:";
+	for (int b = 0; b < 9; b++) {
+		if (histogram[b]) cout << " " << bins[b] << ":" << histogram[b];
+	}
+	cout << endl;
+
+	size_t boxBytes = numNodes * sizeof(Box);
+	size_t nodeBytes = numNodes * sizeof(FlatNode);
+	size_t boundsBytes = interior * sizeof(ChildBounds);
+	size_t pointBytes = numPoints * sizeof(int);
+	size_t faceBytes = bUseFaces ? numPoints * sizeof(float) * 9 : 0;
+	cout << "bytes: nodes " << nodeBytes << " (boxes " << boxBytes << ") child bounds " << boundsBytes
+		<< " point lists " << pointBytes;
+	if (faceBytes) cout << " face data " << faceBytes;
+	cout << " total " << nodeBytes + boundsBytes + pointBytes + faceBytes << endl;
+}
+
+// subdivideParallel:  split the top of the tree breadth-first until there are
+//                     a few independent subtrees per thread, then build those
+//                     subtrees on a pool of worker threads.  Each subtree is
+//                     built by the same serial subdivide(), so the result is
+//                     identical to a single-threaded build.
+//
+void Octree::subdivideParallel(int numLevels, int level, int numThreads) {
+	vector<TreeNode *> work;
+	vector<int> workLevel;
+	work.push_back(&root);
+	workLevel.push_back(level);
+
+	while (work.size() < numThreads * 4) {
+		vector<TreeNode *> next;
+		vector<int> nextLevel;
+		for (int i = 0; i < work.size(); i++) {
+			if (!canSplit(work[i]->box, workLevel[i], numLevels)) {
 				numLeaf++;
+				continue;
+			}
+			numLeaf += splitNode(*work[i]);
+			for (int c = 0; c < work[i]->children.size(); c++) {
+				if (work[i]->children[c].numPoints() > leafCapacity()) {
+					next.push_back(&work[i]->children[c]);
+					nextLevel.push_back(workLevel[i] + 1);
+				}
+			}
+		}
+		work.swap(next);
+		workLevel.swap(nextLevel);
+		if (work.empty()) return;
+	}
+
+	// worker pool: each thread pulls the next subtree until none are left
+	//
+	atomic<int> nextTask(0);
+	vector<int> leafCount(numThreads, 0);
+	vector<thread> pool;
+	for (int t = 0; t < numThreads; t++) {
+		pool.push_back(thread([&, t]() {
+			for (int i = nextTask++; i < work.size(); i = nextTask++)
+				subdivide(*work[i], numLevels, workLevel[i], leafCount[t]);
+		}));
+	}
+	for (int t = 0; t < numThreads; t++) {
+		pool[t].join();
+		numLeaf += leafCount[t];
+	}
+}
+
+// Morton (Z-order) build helpers.  Keys interleave one bit per axis per level,
+// most significant level first.  Within a level the 3 bits are ordered so that
+// they count in subDivideBox8() order (y selects the upper floor, then x/z go
+// round the floor), so sorted keys visit children in the same order as the
+// top-down build.  21 bits per axis fit in a 63-bit key.
+//
+static const int MortonBits = 21;
+
+static uint64_t mortonKey(const Vector3 & p, const Box & bounds, int bits) {
+	Vector3 size = bounds.max() - bounds.min();
+	unsigned int q[3];
+	for (int a = 0; a < 3; a++) {
+		float s = size[a] > 0 ? (p[a] - bounds.min()[a]) / size[a] : 0;
+		float c = s * (1u << bits);
+		q[a] = c <= 0 ? 0 : (c >= (1u << bits) ? (1u << bits) - 1 : (unsigned int)c);
+	}
+	uint64_t key = 0;
+	for (int b = bits - 1; b >= 0; b--) {
+		int x = (q[0] >> b) & 1, y = (q[1] >> b) & 1, z = (q[2] >> b) & 1;
+		int floor = z ? (x ? 2 : 3) : x;
+		key = (key << 3) | (y << 2) | floor;
+	}
+	return key;
+}
+
+// LSD radix sort of (key, index) pairs on the low "bits" bits of the keys,
+// 8 bits per pass.
+//
+static void radixSort(vector<uint64_t> & keys, vector<int> & index, int bits) {
+	int n = keys.size();
+	vector<uint64_t> keysTmp(n);
+	vector<int> indexTmp(n);
+	for (int shift = 0; shift < bits; shift += 8) {
+		int count[257] = { 0 };
+		for (int i = 0; i < n; i++) count[((keys[i] >> shift) & 0xff) + 1]++;
+		for (int d = 0; d < 256; d++) count[d + 1] += count[d];
+		for (int i = 0; i < n; i++) {
+			int dst = count[(keys[i] >> shift) & 0xff]++;
+			keysTmp[dst] = keys[i];
+			indexTmp[dst] = index[i];
+		}
+		keys.swap(keysTmp);
+		index.swap(indexTmp);
+	}
+}
+
+// number of leading levels two keys have in common
+//
+static int commonLevels(uint64_t a, uint64_t b, int bits) {
+	int d = 0;
+	while (d < bits && ((a >> (3 * (bits - 1 - d))) & 7) == ((b >> (3 * (bits - 1 - d))) & 7)) d++;
+	return d;
+}
+
+// buildMorton:  bottom-up alternative to subdivide().  Compute a Morton key for
+//               every point from the root box, radix sort the keys, then emit
+//               the tree in one sweep over the sorted points.  A point's leaf
+//               sits one level below the deepest level it shares with either
+//               neighbour in sorted order; the nodes it shares with the
+//               previous point already exist, the rest are created here.
+//               The sorted order becomes "points", so each node is just the
+//               run of sorted positions the sweep spent inside it.
+//
+void Octree::buildMorton(int numLevels) {
+	int bits = numLevels - 1;
+	if (bits > MortonBits) bits = MortonBits;
+	if (bits < 1 || root.numPoints() < 2) return;
+
+	int n = root.numPoints();
+	vector<uint64_t> keys(n);
+	for (int i = 0; i < n; i++) {
+		ofVec3f v = view.vertex(points[i]);
+		keys[i] = mortonKey(Vector3(v.x, v.y, v.z), root.box, bits);
+	}
+	radixSort(keys, points, 3 * bits);
+
+	// open[d] is the node at depth d on the path of the current point; its
+	// run ends where the sweep leaves it.  childBoxes[d] caches
+	// subDivideBox8() of open[d] once it gets a child.
+	//
+	vector<TreeNode *> open(bits + 1);
+	vector<vector<Box>> childBoxes(bits + 1);
+	open[0] = &root;
+
+	int prevCommon = 0;
+	int pathDepth = 0;
+	for (int i = 0; i < n; i++) {
+		for (int d = pathDepth; d > prevCommon; d--)
+			open[d]->end = i;
+
+		int nextCommon = i + 1 < n ? commonLevels(keys[i], keys[i + 1], bits) : 0;
+		int leafDepth = (prevCommon > nextCommon ? prevCommon : nextCommon) + 1;
+		if (leafDepth > bits) leafDepth = bits;
+		if (leafDepth > prevCommon) numLeaf++;		// a new leaf, not one more point in the last
+
+		for (int d = prevCommon + 1; d <= leafDepth; d++) {
+			TreeNode & parent = *open[d - 1];
+			if (parent.children.empty()) {
+				subDivideBox8(parent.box, childBoxes[d - 1]);
+				parent.children.reserve(8);
+			}
+			int octant = (keys[i] >> (3 * (bits - d))) & 7;
+			parent.children.push_back(TreeNode());
+			open[d] = &parent.children.back();
+			open[d]->box = childBoxes[d - 1][octant];
+			open[d]->octant = octant;
+			open[d]->begin = i;
+		}
+		pathDepth = leafDepth > prevCommon ? leafDepth : pathDepth;
+		prevCommon = nextCommon;
+	}
+	for (int d = pathDepth; d >= 0; d--)
+		open[d]->end = n;
+}
+
+// benchmarkBuild:  build the octree for "mesh" with 1 to maxThreads threads
+//                  and print the build time and speed-up for each.
+//
+void Octree::benchmarkBuild(const ofMesh & mesh, int numLevels, int maxThreads) {
+	float serial = 0;
+	for (int n = 1; n <= maxThreads; n++) {
+		Octree tree;
+		uint64_t start = ofGetElapsedTimeMicros();
+		tree.create(mesh, numLevels, n);
+		float ms = (ofGetElapsedTimeMicros() - start) / 1000.0;
+		if (n == 1) serial = ms;
+		cout << "threads: " << n << " build: " << ms << "ms speed-up: " << serial / ms << "x" << endl;
+	}
+}
+
+// benchmarkLeafCapacity:  build point octrees of "mesh" with leaf capacities
+//                         from 1 to 64 points and print, for each, the build
+//                         time, memory, size and depth of the tree and the
+//                         mean time of a ray query, a box query (points in a
+//                         box around a mesh point) and a nearest-point query,
+//                         which is the trade-off behind maxLeafPoints.
+//
+void Octree::benchmarkLeafCapacity(const ofMesh & mesh, int numLevels, float minCellSize) {
+	ofSeedRandom(1);
+	BenchmarkQueries queries;
+	queries.make(MeshView(mesh));
+	const vector<Ray> & rays = queries.rays;
+	const vector<Box> & boxes = queries.boxes;
+
+	cout << "leaf capacity | build ms | memory KB | nodes | depth | ray us | box us | knn us" << endl;
+	int capacity[] = { 1, 2, 4, 8, 16, 32, 64 };
+	for (int c = 0; c < 7; c++) {
+		Octree tree;
+		tree.maxLeafPoints = capacity[c];
+		tree.minCellSize = minCellSize;
+		uint64_t start = ofGetElapsedTimeMicros();
+		tree.create(mesh, numLevels);
+		float buildMs = (ofGetElapsedTimeMicros() - start) / 1000.0;
+
+		vector<int> depth(tree.numNodes, 0);
+		int maxDepth = 0;
+		for (int i = 0; i < tree.numNodes; i++) {
+			const FlatNode & node = tree.nodeData[i];
+			maxDepth = std::max(maxDepth, depth[i]);
+			for (int k = 0; k < node.numChildren(); k++) depth[node.firstChild + k] = depth[i] + 1;
+		}
+
+		RayHit hit;
+		start = ofGetElapsedTimeMicros();
+		for (int i = 0; i < rays.size(); i++) tree.intersect(rays[i], hit);
+		float rayUs = (ofGetElapsedTimeMicros() - start) / (float)rays.size();
+		vector<int> found;
+		start = ofGetElapsedTimeMicros();
+		for (int i = 0; i < boxes.size(); i++) {
+			found.clear();
+			tree.getPointsInBox(boxes[i], found);
+		}
+		float boxUs = (ofGetElapsedTimeMicros() - start) / (float)boxes.size();
+		vector<PointHit> nearest;
+		start = ofGetElapsedTimeMicros();
+		for (int i = 0; i < queries.points.size(); i++) tree.knn(queries.points[i], 1, nearest);
+		float knnUs = (ofGetElapsedTimeMicros() - start) / (float)queries.points.size();
+
+		cout << capacity[c] << " | " << buildMs << " | " << tree.memoryUsage() / 1024 << " | " << tree.numNodes <<
+			" | " << maxDepth << " | " << rayUs << " | " << boxUs << " | " << knnUs << endl;
+	}
+}
+
+// Octree cache file.  The header is followed by the flat arrays exactly as
+// they are laid out in memory, each at a 64-byte aligned offset from the start
+// of the file, so the file can be mapped anywhere and queried in place.  It
+// is tagged with a hash of the mesh and the build settings; load() refuses a
+// file that doesn't match them (or was written with a different version or
+// node layout) and createCached() then rebuilds it.
+//
+static const char CacheMagic[8] = { 'O', 'C', 'T', 'R', 'E', 'E', 'C', 'F' };
+static const uint32_t CacheVersion = 3;
+
+struct CacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;			// 0x01020304 as written by the saving machine
+	uint32_t nodeSize, boundsSize;
+	uint64_t meshHash;
+	int32_t numLevels, useFaces, maxLeafFaces, keepInteriorPoints;
+	int32_t maxLeafPoints;
+	float minCellSize;
+	uint64_t numNodes, numBounds, numPoints, numFaceData;
+	uint64_t numMeshPoints;		// vertices (faces) of the mesh; numPoints is more after updates
+	uint64_t nodesOffset, boundsOffset, pointsOffset, faceOffset;
+	uint64_t fileSize;
+};
+
+// read-only mapping of a whole file, shared between processes
+//
+class MappedFile {
+public:
+	~MappedFile() {
+		if (!data) return;
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap((void *)data, size);
+#endif
+	}
+	bool open(const string & path) {
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER len;
+		HANDLE mapping = NULL;
+		if (GetFileSizeEx(file, &len) && len.QuadPart > 0)
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping) {
+			data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			size = len.QuadPart;
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (p != MAP_FAILED) {
+				data = (const char *)p;
+				size = st.st_size;
 			}
 		}
+		close(fd);
+#endif
+		return data != nullptr;
 	}
+
+	const char *data = nullptr;
+	size_t size = 0;
+};
+
+// meshHash:  64-bit FNV-1a hash of the vertex positions and index data of a
+//           mesh (the same for an ofMesh and a view of it, whatever the
+//           view's stride)
+//
+uint64_t Octree::meshHash(const MeshView & mesh) {
+	uint64_t h = 14695981039346656037ull;
+	for (int v = 0; v < mesh.numVertices; v++) {
+		const unsigned char *p = (const unsigned char *)(mesh.vertices + (size_t)v * mesh.stride);
+		for (size_t i = 0; i < 3 * sizeof(float); i++) h = (h ^ p[i]) * 1099511628211ull;
+	}
+	const unsigned char *p = (const unsigned char *)mesh.indices;
+	size_t n = mesh.numIndices * sizeof(ofIndexType);
+	for (size_t i = 0; i < n; i++) h = (h ^ p[i]) * 1099511628211ull;
+	return h;
+}
+
+// bindArrays:  point the query arrays at the vectors filled by the build,
+//              and the view at the octree's own copy of the mesh if it has one
+//
+void Octree::bindArrays() {
+	if (mesh.getNumVertices() > 0) view = MeshView(mesh);
+	if (!packed.empty()) {
+		view.vertices = packed.data();
+		view.stride = 3;
+	}
+	cache.reset();
+	bindVectors();
+}
+
+// bindVectors:  point the query arrays at the vectors again after they grew
+//               (expanding a lazy node)
+//
+void Octree::bindVectors() const {
+	nodeData = nodes.data();
+	numNodes = nodes.size();
+	boundsData = childBounds.data();
+	pointData = points.data();
+	numPointData = points.size();
+	for (int k = 0; k < 9; k++) faceCols[k] = faceData[k].data();
+}
+
+static uint64_t alignOffset(uint64_t offset) {
+	return (offset + 63) & ~(uint64_t)63;
+}
+
+// save:  write the flat arrays to "path".  The file is written under a
+//        temporary name and then renamed so that another process never maps
+//        a half written cache.  A lazy octree is saved only once it has been
+//        expanded everywhere.
+//
+bool Octree::save(const string & path) const {
+	if (numNodes == 0 || numPending() > 0) return false;
+	CacheHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CacheMagic, sizeof(h.magic));
+	h.version = CacheVersion;
+	h.byteOrder = 0x01020304;
+	h.nodeSize = sizeof(FlatNode);
+	h.boundsSize = sizeof(ChildBounds);
+	h.meshHash = meshHash(view);
+	h.numLevels = levels;
+	h.useFaces = bUseFaces;
+	h.maxLeafFaces = maxLeafFaces;
+	h.maxLeafPoints = maxLeafPoints;
+	h.minCellSize = minCellSize;
+	h.keepInteriorPoints = bKeepInteriorPoints;
+	h.numNodes = numNodes;
+	for (int i = 0; i < numNodes; i++) {
+		if (nodeData[i].bounds >= 0) h.numBounds = std::max(h.numBounds, (uint64_t)nodeData[i].bounds + 1);
+	}
+	h.numPoints = numPointData;
+	h.numMeshPoints = bUseFaces ? view.numFaces() : view.numVertices;
+	h.numFaceData = bUseFaces ? h.numPoints + 3 : 0;	// padded as in loadFaceData()
+	h.nodesOffset = alignOffset(sizeof(h));
+	h.boundsOffset = alignOffset(h.nodesOffset + h.numNodes * sizeof(FlatNode));
+	h.pointsOffset = alignOffset(h.boundsOffset + h.numBounds * sizeof(ChildBounds));
+	h.faceOffset = alignOffset(h.pointsOffset + h.numPoints * sizeof(int));
+	h.fileSize = h.faceOffset + h.numFaceData * sizeof(float) * 9;
+
+	string tmp = path + ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "wb");
+	if (!fp) return false;
+	struct Section { uint64_t offset; const void *data; size_t bytes; };
+	Section sections[4 + 9] = {
+		{ 0, &h, sizeof(h) },
+		{ h.nodesOffset, nodeData, h.numNodes * sizeof(FlatNode) },
+		{ h.boundsOffset, boundsData, h.numBounds * sizeof(ChildBounds) },
+		{ h.pointsOffset, pointData, h.numPoints * sizeof(int) },
+	};
+	for (int k = 0; k < 9; k++)
+		sections[4 + k] = { h.faceOffset + k * h.numFaceData * sizeof(float), faceCols[k], h.numFaceData * sizeof(float) };
+	bool ok = true;
+	uint64_t pos = 0;
+	for (int i = 0; i < 4 + 9 && ok; i++) {
+		for (; pos < sections[i].offset; pos++) ok = ok && fputc(0, fp) != EOF;
+		if (sections[i].bytes) ok = ok && fwrite(sections[i].data, sections[i].bytes, 1, fp) == 1;
+		pos += sections[i].bytes;
+	}
+	ok = (fclose(fp) == 0) && ok;
+	if (ok) {
+		::remove(path.c_str());
+		ok = rename(tmp.c_str(), path.c_str()) == 0;
+	}
+	if (!ok) ::remove(tmp.c_str());
+	return ok;
+}
+
+// load:  map the cache file at "path" and query it in place.  Returns false,
+//        leaving the octree unchanged, if there is no cache or it was built
+//        from a different mesh or with different settings.  load(ofMesh)
+//        keeps a copy of the mesh, load(MeshView) reads the caller's arrays.
+//
+bool Octree::load(const string & path, const ofMesh & geo, int numLevels) {
+	if (!load(path, MeshView(geo), numLevels)) return false;
+	mesh = geo;
+	setMesh(MeshView(mesh));
+	return true;
+}
+
+bool Octree::load(const string & path, const MeshView & geo, int numLevels) {
+	shared_ptr<MappedFile> file = make_shared<MappedFile>();
+	if (!file->open(path) || file->size < sizeof(CacheHeader)) return false;
+	const CacheHeader & h = *(const CacheHeader *)file->data;
+	if (memcmp(h.magic, CacheMagic, sizeof(h.magic)) != 0 || h.version != CacheVersion ||
+		h.byteOrder != 0x01020304 || h.nodeSize != sizeof(FlatNode) || h.boundsSize != sizeof(ChildBounds) ||
+		h.fileSize != file->size || h.numNodes == 0)
+		return false;
+	if (h.numLevels != numLevels || h.useFaces != bUseFaces || h.maxLeafFaces != maxLeafFaces ||
+		h.keepInteriorPoints != bKeepInteriorPoints || h.maxLeafPoints != maxLeafPoints ||
+		h.minCellSize != minCellSize)
+		return false;
+	uint64_t numPoints = bUseFaces ? geo.numFaces() : geo.numVertices;
+	if (h.numMeshPoints != numPoints || h.numPoints < numPoints || h.meshHash != meshHash(geo)) return false;
+	if (h.nodesOffset + h.numNodes * sizeof(FlatNode) > h.boundsOffset ||
+		h.boundsOffset + h.numBounds * sizeof(ChildBounds) > h.pointsOffset ||
+		h.pointsOffset + h.numPoints * sizeof(int) > h.faceOffset ||
+		h.faceOffset + h.numFaceData * sizeof(float) * 9 > h.fileSize)
+		return false;
+
+	setMesh(geo);
+	levels = numLevels;
+	bUpdatesReady = false;
+	deadNodes = deadPoints = 0;
+	lazy.reset();
+	root = TreeNode();
+	nodes.clear();
+	childBounds.clear();
+	points.clear();
+	for (int k = 0; k < 9; k++) faceData[k].clear();
+	cache = file;
+	nodeData = (const FlatNode *)(file->data + h.nodesOffset);
+	numNodes = h.numNodes;
+	boundsData = (const ChildBounds *)(file->data + h.boundsOffset);
+	pointData = (const int *)(file->data + h.pointsOffset);
+	numPointData = h.numPoints;
+	for (int k = 0; k < 9; k++)
+		faceCols[k] = (const float *)(file->data + h.faceOffset + k * h.numFaceData * sizeof(float));
+	root.box = nodeData[0].box;
+	root.end = h.numMeshPoints;
+	return true;
+}
+
+// createCached:  load the octree from the cache at "path", or build it and
+//                write the cache when it is missing or stale.
+//
+void Octree::createCached(const string & path, const ofMesh & geo, int numLevels, int numThreads) {
+	mesh = geo;
+	createCached(path, MeshView(mesh), numLevels, numThreads);
+}
+
+void Octree::createCached(const string & path, const MeshView & geo, int numLevels, int numThreads) {
+	uint64_t start = ofGetElapsedTimeMillis();
+	if (load(path, geo, numLevels)) {
+		cout << "Loaded octree cache " << path << ": " << ofGetElapsedTimeMillis() - start << "ms" << endl;
+		return;
+	}
+	create(geo, numLevels, numThreads);
+	if (numPending() > 0) return;		// nothing to cache until it is all expanded
+	if (!save(path)) cout << "Could not write octree cache " << path << endl;
 }
 
 // Implement functions below for Homework project
 //
 
-//using recursion
-bool Octree::intersect(const Ray &ray, const TreeNode & node, TreeNode & nodeRtn) {
+//using recursion.  nodeRtn points at the node hit, in the tree (which
+//must be kept, bKeepTree)
+bool Octree::intersect(const Ray &ray, const TreeNode & node, const TreeNode *& nodeRtn) const {
 	bool intersects = false;
-	if (node.points.size() == 1) {
+	if (node.numPoints() == 1) {
 		intersects = node.box.intersect(ray, -1000, 1000);
 		if (intersects)
 		{
-			nodeRtn = node;
+			nodeRtn = &node;
 		}
 	}
 	else {
@@ -221,38 +1186,1872 @@ bool Octree::intersect(const Ray &ray, const TreeNode & node, TreeNode & nodeRtn
 
 
 //using recursion
-bool Octree::intersect(const Box &box, TreeNode & node, vector<Box> & boxListRtn) {
+bool Octree::intersect(const Box &box, const TreeNode & node, vector<Box> & boxListRtn) const {
 	bool intersects = false;
 	//use the overlap method built in box.h
 	if (node.box.overlap(box)) {
-		if (node.points.size() == 1) {
+		if (node.children.empty()) {
 			boxListRtn.push_back(node.box);
 			intersects = true;
 			return intersects;
 		}
 		for (int i = 0; i < node.children.size(); i++) {
-			intersect(box, node.children[i], boxListRtn);
+			if (intersect(box, node.children[i], boxListRtn)) intersects = true;
 		}
 	}
+	return intersects;
 }
 
-//referred to octree readme
-void Octree::draw(TreeNode & node, int numLevels, int level) {
-	if (level >= numLevels) return;
-	ofSetColor(colors[level]);
-	drawBox(node.box);
-	level++;
-	for (int i = 0; i < node.children.size(); i++) {
-		draw(node.children[i], numLevels, level);
+// flatten:  copy the tree into "nodes" in breadth-first order so that all the
+//           children of a node are contiguous.  "order" holds the tree node
+//           that each flat node was made from.  Each interior node also gets
+//           the SoA boxes of its children in childBounds.  flatten(t, node)
+//           appends the subtree below "t" as the descendants of flat node
+//           "node" (an expanded lazy node).
+//
+static int countNodes(const TreeNode & node, int & interior) {
+	int n = 1;
+	if (!node.children.empty()) interior++;
+	for (int i = 0; i < node.children.size(); i++)
+		n += countNodes(node.children[i], interior);
+	return n;
+}
+
+void Octree::flatten() {
+	int interior = 0;
+	int n = countNodes(root, interior);
+	nodes.clear();
+	nodes.reserve(n);
+	childBounds.clear();
+	childBounds.reserve(interior);
+	nodes.push_back(FlatNode());
+	nodes[0].box = root.box;
+	flatten(root, 0);
+}
+
+void Octree::flatten(const TreeNode & tree, int node) const {
+	int interior = 0;
+	vector<pair<const TreeNode *, int>> order;
+	order.reserve(countNodes(tree, interior));
+	order.push_back(make_pair(&tree, node));
+	for (int j = 0; j < order.size(); j++) {
+		const TreeNode & t = *order[j].first;
+		int i = order[j].second;
+		nodes[i].begin = t.begin;
+		nodes[i].end = t.end;
+		if (t.children.empty()) continue;
+
+		nodes[i].firstChild = nodes.size();
+		nodes[i].bounds = childBounds.size();
+		ChildBounds cb;
+		for (int a = 0; a < 3; a++) {
+			for (int k = 0; k < 8; k++) {
+				cb.lo[a][k] = FLT_MAX;
+				cb.hi[a][k] = -FLT_MAX;
+			}
+		}
+		for (int c = 0; c < t.children.size(); c++) {
+			FlatNode f;
+			f.box = t.children[c].box;
+			nodes.push_back(f);
+			order.push_back(make_pair(&t.children[c], (int)nodes.size() - 1));
+			nodes[i].childMask |= 1 << t.children[c].octant;
+			for (int a = 0; a < 3; a++) {
+				cb.lo[a][c] = f.box.parameters[0][a];
+				cb.hi[a][c] = f.box.parameters[1][a];
+			}
+		}
+		childBounds.push_back(cb);
 	}
 }
 
-// Optional
+// markPending:  after a lazy create(), mark the leaves at the last prebuilt
+//               level that subdivide() would have split further, and keep
+//               their cells.  "rootCell" is the root box before any refit.
 //
-void Octree::drawLeafNodes(TreeNode & node) {
+void Octree::markPending(const Box & rootCell) {
+	lazy = make_shared<LazyNodes>();
+	lazy->depth = prebuiltLevels;
+	vector<pair<int, Box>> stack(1, make_pair(0, rootCell));
+	vector<int> stackDepth(1, 0);
+	while (!stack.empty()) {
+		int i = stack.back().first, depth = stackDepth.back();
+		Box cell = stack.back().second;
+		stack.pop_back();
+		stackDepth.pop_back();
+		if (nodes[i].isLeaf()) {
+			if (nodes[i].numPoints() > leafCapacity() && canSplit(cell, depth + 1, levels)) {
+				nodes[i].bounds = -2 - (int)lazy->cells.size();
+				lazy->cells.push_back(cell);
+			}
+			continue;
+		}
+		Box box[8];
+		subDivideBox8(cell, box);
+		for (int b = 0; b < 8; b++) {
+			int c = nodes[i].child(b);
+			if (c < 0) continue;
+			stack.push_back(make_pair(c, box[b]));
+			stackDepth.push_back(depth + 1);
+		}
+	}
+	lazy->pending = lazy->cells.size();
+}
 
+// numPending:  nodes of a lazy octree not expanded yet
+//
+int Octree::numPending() const {
+	return lazy ? lazy->pending.load() : 0;
 }
 
+// expand:  expand the pending nodes whose boxes overlap "region", or the
+//          nodes in "pending".  A node is expanded once: one that is no
+//          longer pending by the time the exclusive lock is taken (another
+//          thread got there first) is skipped.
+//
+void Octree::expand(const Box & region) {
+	if (numPending() == 0) return;
+	vector<int> found;
+	lazy->lock.lock_shared();
+	pendingNodes(*this, [&](const Box & b) { return b.overlap(region); }, INT_MAX, found);
+	lazy->lock.unlock_shared();
+	expand(found);
+}
 
+void Octree::expand(const vector<int> & pending) const {
+	if (!lazy) return;
+	unique_lock<shared_mutex> hold(lazy->lock);
+	for (int k = 0; k < pending.size(); k++) {
+		if (pending[k] < nodes.size() && nodes[pending[k]].isPending()) expandNode(pending[k]);
+	}
+}
+
+// expandNode:  build the subtree of pending node i as create() would have,
+//              and append it to the flat arrays.  The node's points are
+//              reordered within its run, so no query may be running (see
+//              expand()).  A lazy octree never reads a mapped cache, so
+//              only the vectors are rebound.
+//
+void Octree::expandNode(int i) const {
+	TreeNode t;
+	t.box = lazy->cells[nodes[i].pendingCell()];
+	t.begin = nodes[i].begin;
+	t.end = nodes[i].end;
+	nodes[i].bounds = -1;
+	if (t.numPoints() > leafCapacity()) {
+		numLeaf--;			// counted as a leaf at the prebuilt levels
+		loadBuildCoords(t.begin, t.end);
+		subdivide(t, levels, lazy->depth + 1);
+		freeBuildCoords();
+		if (bUseFaces) {
+			refitFaceBoxes(t);
+			for (int k = t.begin; k < t.end; k++) loadFace(k);
+		}
+		if (!bKeepInteriorPoints) dropInteriorPoints(t);
+		flatten(t, i);
+	}
+	bUpdatesReady = false;
+	bindVectors();
+	lazy->pending--;
+}
+
+// hitChildren:  test the ray against all the children of "node" at once.
+//               Returns the mask of children (bit k = firstChild + k) that the
+//               ray enters inside (tMin, tMax), and their entry distances.
+//
+int Octree::hitChildren(const Ray &ray, const FlatNode & node, float tMin, float tMax, float tRtn[8]) const {
+	const float o[3] = { ray.origin.x(), ray.origin.y(), ray.origin.z() };
+	const float inv[3] = { ray.inv_direction.x(), ray.inv_direction.y(), ray.inv_direction.z() };
+	const ChildBounds & cb = boundsData[node.bounds];
+	return slabTest8(o, inv, ray.sign, cb.lo, cb.hi, tMin, tMax, tRtn) & ((1 << node.numChildren()) - 1);
+}
+
+// ray query over the flat array: returns the index of the first leaf found, in
+// the same child order as the recursive version.  Children are pushed in
+// reverse so that they come off the stack in subDivideBox8() order.
+//
+bool Octree::intersect(const Ray &ray, int & nodeRtn) const {
+	LazyLock lock(*this, [&](const Box & b) { return b.intersect(ray, -1000, 1000); });
+	STATS_QUERY();
+	if (numNodes == 0 || !nodeData[0].box.intersect(ray, -1000, 1000)) return false;
+
+	int stack[MaxStack];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const FlatNode & node = nodeData[stack[--top]];
+		STATS_NODE();
+		if (node.isLeaf()) {
+			STATS_LEAF();
+			nodeRtn = &node - nodeData;
+			return true;
+		}
+		float t[8];
+		int mask = hitChildren(ray, node, -1000, 1000, t);
+		STATS_BOXES(node.numChildren());
+		for (int k = node.numChildren() - 1; k >= 0; k--) {
+			if (mask & (1 << k))
+				stack[top++] = node.firstChild + k;
+		}
+		STATS_STACK(top);
+	}
+	return false;
+}
+
+// box query over the flat array: collect the boxes of all leaf nodes that
+// overlap "box".
+//
+bool Octree::intersect(const Box &box, vector<Box> & boxListRtn) const {
+	LazyLock lock(*this, [&](const Box & b) { return b.overlap(box); });
+	STATS_QUERY();
+	if (numNodes == 0 || !nodeData[0].box.overlap(box)) return false;
+
+	const float bmin[3] = { box.parameters[0].x(), box.parameters[0].y(), box.parameters[0].z() };
+	const float bmax[3] = { box.parameters[1].x(), box.parameters[1].y(), box.parameters[1].z() };
+	bool intersects = false;
+	int stack[MaxStack];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const FlatNode & node = nodeData[stack[--top]];
+		STATS_NODE();
+		if (node.isLeaf()) {
+			STATS_LEAF();
+			boxListRtn.push_back(node.box);
+			intersects = true;
+			continue;
+		}
+		const ChildBounds & cb = boundsData[node.bounds];
+		int mask = overlap8(cb.lo, cb.hi, bmin, bmax);
+		STATS_BOXES(node.numChildren());
+		for (int k = node.numChildren() - 1; k >= 0; k--) {
+			if (mask & (1 << k))
+				stack[top++] = node.firstChild + k;
+		}
+		STATS_STACK(top);
+	}
+	return intersects;
+}
+
+// box query family.  All of them descend through the children that overlap
+// the box, using the SoA child bounds.  maxDepth stops the descent early (the
+// root is depth 0): a node at that depth counts as a leaf, which is enough for
+// coarse collision tests.
+//
+// intersectAny:  true as soon as one leaf overlapping "box" is found
+//
+bool Octree::intersectAny(const Box &box, int maxDepth) const {
+	LazyLock lock(*this, [&](const Box & b) { return b.overlap(box); }, maxDepth);
+	STATS_QUERY();
+	if (numNodes == 0 || !nodeData[0].box.overlap(box)) return false;
+
+	const float bmin[3] = { box.parameters[0].x(), box.parameters[0].y(), box.parameters[0].z() };
+	const float bmax[3] = { box.parameters[1].x(), box.parameters[1].y(), box.parameters[1].z() };
+	int stack[MaxStack];
+	int stackDepth[MaxStack];
+	int top = 0;
+	stack[top] = 0;
+	stackDepth[top++] = 0;
+	while (top > 0) {
+		top--;
+		const FlatNode & node = nodeData[stack[top]];
+		int depth = stackDepth[top];
+		STATS_NODE();
+		if (node.isLeaf() || depth >= maxDepth) {
+			STATS_LEAF();
+			return true;
+		}
+		const ChildBounds & cb = boundsData[node.bounds];
+		int mask = overlap8(cb.lo, cb.hi, bmin, bmax);
+		STATS_BOXES(node.numChildren());
+		for (int k = node.numChildren() - 1; k >= 0; k--) {
+			if (!(mask & (1 << k))) continue;
+			stack[top] = node.firstChild + k;
+			stackDepth[top++] = depth + 1;
+		}
+		STATS_STACK(top);
+	}
+	return false;
+}
+
+// intersectTop:  any-hit test that also returns the highest top (max y) of
+//                the leaves overlapping "box".  Children are visited highest
+//                first and a subtree whose top is below the best so far is
+//                skipped.  Child boxes can round a few ulps above their
+//                parent, so "below" allows a small tolerance.
+//
+bool Octree::intersectTop(const Box &box, float & topRtn, int maxDepth) const {
+	LazyLock lock(*this, [&](const Box & b) { return b.overlap(box); }, maxDepth);
+	STATS_QUERY();
+	if (numNodes == 0 || !nodeData[0].box.overlap(box)) return false;
+
+	const float bmin[3] = { box.parameters[0].x(), box.parameters[0].y(), box.parameters[0].z() };
+	const float bmax[3] = { box.parameters[1].x(), box.parameters[1].y(), box.parameters[1].z() };
+	bool found = false;
+	float best = -FLT_MAX;
+	float eps = (nodeData[0].box.max().y() - nodeData[0].box.min().y()) * 1e-5f;
+	int stack[MaxStack];
+	int stackDepth[MaxStack];
+	float stackTop[MaxStack];
+	int top = 0;
+	stack[top] = 0;
+	stackDepth[top] = 0;
+	stackTop[top++] = nodeData[0].box.max().y();
+	while (top > 0) {
+		top--;
+		if (found && stackTop[top] < best - eps) continue;
+		const FlatNode & node = nodeData[stack[top]];
+		int depth = stackDepth[top];
+		STATS_NODE();
+		if (node.isLeaf() || depth >= maxDepth) {
+			STATS_LEAF();
+			best = std::max(best, stackTop[top]);
+			found = true;
+			continue;
+		}
+		const ChildBounds & cb = boundsData[node.bounds];
+		int mask = overlap8(cb.lo, cb.hi, bmin, bmax);
+		STATS_BOXES(node.numChildren());
+
+		// push lowest first so the highest child comes off the stack first
+		//
+		int child[8];
+		int n = 0;
+		for (int k = 0; mask; k++, mask >>= 1) {
+			if (!(mask & 1) || (found && cb.hi[1][k] < best - eps)) continue;
+			int j = n++;
+			for (; j > 0 && cb.hi[1][child[j - 1]] > cb.hi[1][k]; j--) child[j] = child[j - 1];
+			child[j] = k;
+		}
+		for (int i = 0; i < n; i++) {
+			stack[top] = node.firstChild + child[i];
+			stackDepth[top] = depth + 1;
+			stackTop[top++] = cb.hi[1][child[i]];
+		}
+		STATS_STACK(top);
+	}
+	if (found) topRtn = best;
+	return found;
+}
+
+// countInBox:  number of leaves overlapping "box", without collecting them
+//
+int Octree::countInBox(const Box &box, int maxDepth) const {
+	LazyLock lock(*this, [&](const Box & b) { return b.overlap(box); }, maxDepth);
+	STATS_QUERY();
+	if (numNodes == 0 || !nodeData[0].box.overlap(box)) return 0;
+
+	const float bmin[3] = { box.parameters[0].x(), box.parameters[0].y(), box.parameters[0].z() };
+	const float bmax[3] = { box.parameters[1].x(), box.parameters[1].y(), box.parameters[1].z() };
+	int count = 0;
+	int stack[MaxStack];
+	int stackDepth[MaxStack];
+	int top = 0;
+	stack[top] = 0;
+	stackDepth[top++] = 0;
+	while (top > 0) {
+		top--;
+		const FlatNode & node = nodeData[stack[top]];
+		int depth = stackDepth[top];
+		STATS_NODE();
+		if (node.isLeaf() || depth >= maxDepth) {
+			STATS_LEAF();
+			count++;
+			continue;
+		}
+		const ChildBounds & cb = boundsData[node.bounds];
+		int mask = overlap8(cb.lo, cb.hi, bmin, bmax);
+		STATS_BOXES(node.numChildren());
+		for (int k = node.numChildren() - 1; k >= 0; k--) {
+			if (!(mask & (1 << k))) continue;
+			stack[top] = node.firstChild + k;
+			stackDepth[top++] = depth + 1;
+		}
+		STATS_STACK(top);
+	}
+	return count;
+}
+
+// span query:  append the point run of every leaf overlapping "box" to
+//              "spans".  The spans point into the octree's own index buffer,
+//              so nothing is copied; they stay valid until the tree changes.
+//              Returns the number of spans.
+//
+int Octree::intersect(const Box &box, vector<PointSpan> & spans) const {
+	LazyLock lock(*this, [&](const Box & b) { return b.overlap(box); });
+	STATS_QUERY();
+	if (numNodes == 0 || !nodeData[0].box.overlap(box)) return 0;
+
+	const float bmin[3] = { box.parameters[0].x(), box.parameters[0].y(), box.parameters[0].z() };
+	const float bmax[3] = { box.parameters[1].x(), box.parameters[1].y(), box.parameters[1].z() };
+	int count = 0;
+	int stack[MaxStack];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int i = stack[--top];
+		const FlatNode & node = nodeData[i];
+		STATS_NODE();
+		if (node.isLeaf()) {
+			STATS_LEAF();
+			PointSpan span;
+			span.begin = pointData + node.begin;
+			span.end = pointData + node.end;
+			span.node = i;
+			spans.push_back(span);
+			count++;
+			continue;
+		}
+		const ChildBounds & cb = boundsData[node.bounds];
+		int mask = overlap8(cb.lo, cb.hi, bmin, bmax);
+		STATS_BOXES(node.numChildren());
+		for (int k = node.numChildren() - 1; k >= 0; k--) {
+			if (mask & (1 << k))
+				stack[top++] = node.firstChild + k;
+		}
+		STATS_STACK(top);
+	}
+	return count;
+}
+
+// intersect:  nodes at depth "level" (the root is 0), and leaves above it,
+//             whose boxes are inside or cross "frustum", in depth-first
+//             order.  The planes are not tested again below a node that is
+//             inside all of them.  Returns the number of nodes added.
+//
+int Octree::intersect(const Frustum & frustum, int level, vector<int> & nodesRtn) const {
+	LazyLock lock(*this);
+	STATS_QUERY();
+	if (numNodes == 0) return 0;
+
+	int count = 0;
+	int stack[MaxStack];
+	int stackDepth[MaxStack];
+	bool stackInside[MaxStack];
+	int top = 0;
+	stack[top] = 0;
+	stackDepth[top] = 0;
+	stackInside[top++] = false;
+	while (top > 0) {
+		top--;
+		int i = stack[top], depth = stackDepth[top];
+		bool inside = stackInside[top];
+		const FlatNode & node = nodeData[i];
+		STATS_NODE();
+		if (!inside) {
+			STATS_BOXES(1);
+			int c = frustum.classify(node.box);
+			if (c < 0) continue;
+			inside = c > 0;
+		}
+		if (node.isLeaf() || depth >= level) {
+			if (node.isLeaf()) STATS_LEAF();
+			nodesRtn.push_back(i);
+			count++;
+			continue;
+		}
+		for (int k = node.numChildren() - 1; k >= 0; k--) {
+			stack[top] = node.firstChild + k;
+			stackDepth[top] = depth + 1;
+			stackInside[top++] = inside;
+		}
+		STATS_STACK(top);
+	}
+	return count;
+}
+
+// getPointsInBox:  return the indices of the mesh points (faces in a face
+//                  octree: those whose leaf overlaps the box) inside "box"
+//
+int Octree::getPointsInBox(const Box & box, vector<int> & pointsRtn) const {
+	return getPointsInBox(box, pointsRtn, QueryContext::local());
+}
+
+int Octree::getPointsInBox(const Box & box, vector<int> & pointsRtn, QueryContext & context) const {
+	LazyLock lock(*this, [&](const Box & b) { return b.overlap(box); });
+	vector<PointSpan> & spans = context.spans;
+	spans.clear();
+	intersect(box, spans);
+	int count = 0;
+	for (int s = 0; s < spans.size(); s++) {
+		for (const int *p = spans[s].begin; p < spans[s].end; p++) {
+			if (!bUseFaces) {
+				ofVec3f v = view.vertex(*p);
+				if (!box.inside(Vector3(v.x, v.y, v.z))) continue;
+			}
+			pointsRtn.push_back(*p);
+			count++;
+		}
+	}
+	return count;
+}
+
+// load the positions of the n (up to 8) mesh points index[0..n) SoA for the
+// leaf kernels; unused lanes repeat the last point
+//
+static void gatherPoints8(const MeshView & mesh, const int *index, int n, float x[8], float y[8], float z[8]) {
+	for (int k = 0; k < 8; k++) {
+		ofVec3f v = mesh.vertex(index[k < n ? k : n - 1]);
+		x[k] = v.x;
+		y[k] = v.y;
+		z[k] = v.z;
+	}
+}
+
+// squared distance from p to a box (0 inside it)
+//
+static float boxDist2(const Box & box, const float p[3]) {
+	float d2 = 0;
+	for (int a = 0; a < 3; a++) {
+		float d = std::max(box.parameters[0][a] - p[a], p[a] - box.parameters[1][a]);
+		if (d > 0) d2 += d * d;
+	}
+	return d2;
+}
+
+// knn:  the k mesh points nearest to p, closest first, in a point octree.
+//       Nodes are visited best-first (nearest box first) from a priority
+//       queue, and the search stops once the nearest remaining box is
+//       farther than the k-th best point found so far.  Returns the number
+//       of points found (less than k only if the tree holds fewer).
+//
+int Octree::knn(const ofVec3f & p, int k, vector<PointHit> & hits) const {
+	return knn(p, k, hits, QueryContext::local());
+}
+
+int Octree::knn(const ofVec3f & p, int k, vector<PointHit> & hits, QueryContext & context) const {
+	LazyLock lock(*this, [&](const Box & b) { return b.inside(Vector3(p.x, p.y, p.z)); });
+	STATS_QUERY();
+	hits.clear();
+	if (numNodes == 0 || k <= 0 || bUseFaces) return 0;
+
+	typedef std::pair<float, int> Entry;		// squared distance, node or point
+	auto farther = [](const Entry & a, const Entry & b) { return a.first > b.first; };
+	vector<Entry> & open = context.open;		// min-heap of nodes
+	vector<Entry> & best = context.best;		// max-heap of the k best points
+	open.clear();
+	best.clear();
+
+	const float q[3] = { p.x, p.y, p.z };
+	open.push_back(Entry(boxDist2(nodeData[0].box, q), 0));
+	while (!open.empty()) {
+		Entry e = open.front();
+		if (best.size() == k && e.first > best.front().first) break;
+		std::pop_heap(open.begin(), open.end(), farther);
+		open.pop_back();
+
+		const FlatNode & node = nodeData[e.second];
+		STATS_NODE();
+		if (node.isLeaf()) {
+			STATS_LEAF();
+			for (int i = node.begin; i < node.end; i += 8) {
+				int n = std::min(8, node.end - i);
+				float x[8], y[8], z[8], d2[8];
+				gatherPoints8(view, pointData + i, n, x, y, z);
+				pointDist8(x, y, z, q, d2);
+				for (int j = 0; j < n; j++) {
+					if (best.size() == k && d2[j] >= best.front().first) continue;
+					best.push_back(Entry(d2[j], pointData[i + j]));
+					std::push_heap(best.begin(), best.end());
+					if (best.size() > k) {
+						std::pop_heap(best.begin(), best.end());
+						best.pop_back();
+					}
+				}
+			}
+			continue;
+		}
+		const ChildBounds & cb = boundsData[node.bounds];
+		float d2[8];
+		boxDist8(cb.lo, cb.hi, q, d2);
+		STATS_BOXES(node.numChildren());
+		for (int c = 0; c < node.numChildren(); c++) {
+			if (best.size() == k && d2[c] > best.front().first) continue;
+			open.push_back(Entry(d2[c], node.firstChild + c));
+			std::push_heap(open.begin(), open.end(), farther);
+		}
+		STATS_STACK(open.size());
+	}
+
+	std::sort_heap(best.begin(), best.end());
+	hits.resize(best.size());
+	for (int i = 0; i < best.size(); i++) {
+		hits[i].index = best[i].second;
+		hits[i].dist = sqrtf(best[i].first);
+	}
+	return hits.size();
+}
+
+// withinRadius:  append every mesh point within distance r of p to "hits"
+//                (in no particular order).  Subtrees whose box is farther
+//                than r are skipped.  Returns the number of points found.
+//
+int Octree::withinRadius(const ofVec3f & p, float r, vector<PointHit> & hits) const {
+	LazyLock lock(*this, [&](const Box & b) { const float q[3] = { p.x, p.y, p.z }; return boxDist2(b, q) <= r * r; });
+	STATS_QUERY();
+	hits.clear();
+	if (numNodes == 0 || bUseFaces) return 0;
+	const float q[3] = { p.x, p.y, p.z };
+	float r2 = r * r;
+	if (boxDist2(nodeData[0].box, q) > r2) return 0;
+
+	int stack[MaxStack];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const FlatNode & node = nodeData[stack[--top]];
+		STATS_NODE();
+		if (node.isLeaf()) {
+			STATS_LEAF();
+			for (int i = node.begin; i < node.end; i += 8) {
+				int n = std::min(8, node.end - i);
+				float x[8], y[8], z[8], d2[8];
+				gatherPoints8(view, pointData + i, n, x, y, z);
+				pointDist8(x, y, z, q, d2);
+				for (int j = 0; j < n; j++) {
+					if (d2[j] > r2) continue;
+					PointHit h;
+					h.index = pointData[i + j];
+					h.dist = sqrtf(d2[j]);
+					hits.push_back(h);
+				}
+			}
+			continue;
+		}
+		const ChildBounds & cb = boundsData[node.bounds];
+		float d2[8];
+		boxDist8(cb.lo, cb.hi, q, d2);
+		STATS_BOXES(node.numChildren());
+		for (int c = node.numChildren() - 1; c >= 0; c--) {
+			if (d2[c] <= r2) stack[top++] = node.firstChild + c;
+		}
+		STATS_STACK(top);
+	}
+	return hits.size();
+}
+
+//referred to octree readme
+void Octree::draw(TreeNode & node, int numLevels, int level) {
+	if (level >= numLevels) return;
+	ofSetColor(colors[level]);
+	drawBox(node.box);
+	level++;
+	for (int i = 0; i < node.children.size(); i++) {
+		draw(node.children[i], numLevels, level);
+	}
+}
+
+// orderChildren:  return the children of "node" that the ray enters inside
+//                  (tMin, tMax), sorted front to back by entry distance.
+//
+int Octree::orderChildren(const Ray &ray, const FlatNode & node, float tMin, float tMax,
+	int childRtn[8], float tRtn[8]) const
+{
+	float tEnter[8];
+	int mask = hitChildren(ray, node, tMin, tMax, tEnter);
+	int n = 0;
+	for (int k = 0; mask; k++, mask >>= 1) {
+		if (!(mask & 1)) continue;
+		int c = node.firstChild + k;
+		float t = tEnter[k];
+		int j = n++;
+		for (; j > 0 && tRtn[j - 1] > t; j--) {
+			tRtn[j] = tRtn[j - 1];
+			childRtn[j] = childRtn[j - 1];
+		}
+		tRtn[j] = t;
+		childRtn[j] = c;
+	}
+	return n;
+}
+
+// ray query returning the closest hit inside (tMin, tMax).  Children are
+// visited front to back, and a node is skipped once the ray enters it beyond
+// the best hit so far.  In a face octree the hit is the exact triangle hit
+// (a leaf's triangles are tested four at a time); in a point octree it is the
+// vertex of the nearest leaf, at the distance where the ray enters the leaf.
+//
+bool Octree::intersect(const Ray &ray, RayHit & hit, float tMin, float tMax) const {
+	LazyLock lock(*this, [&](const Box & b) { return b.intersect(ray, tMin, tMax); });
+	STATS_QUERY();
+	hit = RayHit();
+	hit.t = tMax;
+	if (numNodes == 0) return false;
+
+	int stack[MaxStack];
+	float stackT[MaxStack];
+	int top = 0;
+	if (!nodeData[0].box.intersect(ray, tMin, tMax, stackT[0])) return false;
+	stack[top++] = 0;
+	while (top > 0) {
+		top--;
+		if (stackT[top] >= hit.t) continue;
+		const FlatNode & node = nodeData[stack[top]];
+		STATS_NODE();
+		if (node.isLeaf()) {
+			STATS_LEAF();
+			if (bUseFaces) {
+				intersectLeafFaces(ray, node, tMin, hit);
+			}
+			else {
+				hit.t = stackT[top];
+				hit.node = stack[top];
+				hit.index = nearestLeafPoint(ray, node);
+			}
+			continue;
+		}
+		int child[8];
+		float t[8];
+		int n = orderChildren(ray, node, tMin, hit.t, child, t);
+		STATS_BOXES(node.numChildren());
+		for (int i = n - 1; i >= 0; i--) {
+			stack[top] = child[i];
+			stackT[top++] = t[i];
+		}
+		STATS_STACK(top);
+	}
+	if (hit.index < 0) return false;
+	if (bUseFaces) {
+		hit.point = ray.origin + ray.direction * hit.t;
+	}
+	else {
+		ofVec3f v = view.vertex(hit.index);
+		hit.point = Vector3(v.x, v.y, v.z);
+	}
+	return true;
+}
+
+// intersectSwept:  earliest time of impact of "box" moving by "move" with a
+//                  triangle of a face octree or a point of a point octree.
+//                  hit.t is the fraction of the move (0..1) at which the box
+//                  first touches triangle (point) hit.index of leaf hit.node,
+//                  hit.point where the box's center is then and hit.normal
+//                  the contact normal (see sweepTriangle(); a point the box
+//                  already holds at the start is not counted).  The leaves
+//                  are found by the ray query for the box's center against
+//                  the node boxes grown by the box's half size, front to
+//                  back, stopping at those entered after the best hit.
+//
+bool Octree::intersectSwept(const Box &box, const Vector3 & move, RayHit & hit) const {
+	LazyLock lock(*this, [&](const Box & b) {
+		Vector3 h = (box.max() - box.min()) / 2;
+		return Box(b.min() - h, b.max() + h).intersect(Ray(box.center(), move), 0, 1);
+	});
+	STATS_QUERY();
+	hit = RayHit();
+	hit.t = 1;
+	if (numNodes == 0 || move.length() == 0) return false;
 
+	Vector3 half = (box.max() - box.min()) / 2;
+	Ray ray(box.center(), move);
+	const float o[3] = { ray.origin.x(), ray.origin.y(), ray.origin.z() };
+	const float inv[3] = { ray.inv_direction.x(), ray.inv_direction.y(), ray.inv_direction.z() };
+	const float h[3] = { half.x(), half.y(), half.z() };
 
+	int stack[MaxStack];
+	float stackT[MaxStack];
+	int top = 0;
+	Box root(nodeData[0].box.min() - half, nodeData[0].box.max() + half);
+	if (!root.intersect(ray, 0, 1, stackT[0])) return false;
+	stack[top++] = 0;
+	while (top > 0) {
+		top--;
+		if (stackT[top] >= hit.t) continue;
+		const FlatNode & node = nodeData[stack[top]];
+		STATS_NODE();
+		if (node.isLeaf()) {
+			STATS_LEAF();
+			for (int k = node.begin; k < node.end; k++) {
+				Vector3 tri[3];
+				if (bUseFaces) {
+					tri[0] = Vector3(faceCols[0][k], faceCols[1][k], faceCols[2][k]);
+					tri[1] = tri[0] + Vector3(faceCols[3][k], faceCols[4][k], faceCols[5][k]);
+					tri[2] = tri[0] + Vector3(faceCols[6][k], faceCols[7][k], faceCols[8][k]);
+				}
+				else {
+					ofVec3f v = view.vertex(pointData[k]);
+					tri[0] = tri[1] = tri[2] = Vector3(v.x, v.y, v.z);
+				}
+				float t;
+				Vector3 normal;
+				if (sweepTriangle(box, move, tri, t, normal) && t < hit.t) {
+					hit.t = t;
+					hit.node = stack[top];
+					hit.index = pointData[k];
+					hit.normal = normal;
+				}
+			}
+			continue;
+		}
+
+		// grow the child boxes and order the ones hit front to back
+		//
+		const ChildBounds & cb = boundsData[node.bounds];
+		float lo[3][8], hi[3][8], t[8];
+		for (int a = 0; a < 3; a++) {
+			for (int k = 0; k < 8; k++) {
+				lo[a][k] = cb.lo[a][k] - h[a];
+				hi[a][k] = cb.hi[a][k] + h[a];
+			}
+		}
+		int mask = slabTest8(o, inv, ray.sign, lo, hi, 0, hit.t, t) & ((1 << node.numChildren()) - 1);
+		STATS_BOXES(node.numChildren());
+		int child[8];
+		int n = 0;
+		for (int k = 0; mask; k++, mask >>= 1) {
+			if (!(mask & 1)) continue;
+			int j = n++;
+			for (; j > 0 && t[child[j - 1]] < t[k]; j--) child[j] = child[j - 1];
+			child[j] = k;
+		}
+		for (int i = 0; i < n; i++) {
+			stack[top] = node.firstChild + child[i];
+			stackT[top++] = t[child[i]];
+		}
+		STATS_STACK(top);
+	}
+	if (hit.index < 0) return false;
+	hit.point = ray.origin + move * hit.t;
+	return true;
+}
+
+// packet ray query:  trace up to 16 rays together and return the closest hit
+//                    of each in hits[] (same results as intersect(ray, hit)).
+//                    Each node is fetched once for the whole packet and
+//                    tested against four rays at a time; the packet carries
+//                    on down with just the rays that hit the node.  Children
+//                    are visited near to far for the first ray's direction.
+//                    Returns the number of rays that hit.
+//
+int Octree::intersect(const RayPacket & packet, RayHit hits[], float tMin, float tMax) const {
+	LazyLock lock(*this, [&](const Box & b) {
+		for (int r = 0; r < packet.size; r++) {
+			if (b.intersect(packet.rays[r], tMin, tMax)) return true;
+		}
+		return false;
+	});
+	STATS_QUERY();
+	float tBest[RayPacket::MaxRays + 3];
+	for (int r = 0; r < RayPacket::MaxRays + 3; r++) tBest[r] = tMax;
+	for (int r = 0; r < packet.size; r++) {
+		hits[r] = RayHit();
+		hits[r].t = tMax;
+	}
+	if (numNodes == 0 || packet.size == 0) return 0;
+
+	// pad the SoA arrays to a multiple of 4 with copies of the last ray
+	//
+	float o[3][RayPacket::MaxRays + 3], inv[3][RayPacket::MaxRays + 3];
+	for (int a = 0; a < 3; a++) {
+		for (int r = 0; r < packet.size + 3; r++) {
+			int src = r < packet.size ? r : packet.size - 1;
+			o[a][r] = packet.origin[a][src];
+			inv[a][r] = packet.invDir[a][src];
+		}
+	}
+	const float *op[3] = { o[0], o[1], o[2] };
+	const float *ip[3] = { inv[0], inv[1], inv[2] };
+	const Ray & lead = packet.rays[0];
+	int sign = lead.sign[0] | (lead.sign[1] << 1) | (lead.sign[2] << 2);
+
+	int stack[MaxStack];
+	unsigned int stackMask[MaxStack];
+	int top = 0;
+	stack[top] = 0;
+	stackMask[top++] = (1u << packet.size) - 1;
+	while (top > 0) {
+		top--;
+		int i = stack[top];
+		const FlatNode & node = nodeData[i];
+		STATS_NODE();
+		const float bmin[3] = { node.box.parameters[0].x(), node.box.parameters[0].y(), node.box.parameters[0].z() };
+		const float bmax[3] = { node.box.parameters[1].x(), node.box.parameters[1].y(), node.box.parameters[1].z() };
+
+		unsigned int mask = 0;
+		float tEnter[RayPacket::MaxRays];
+		for (int g = 0; g < packet.size; g += 4) {
+			if (!((stackMask[top] >> g) & 0xf)) continue;
+			mask |= slabTest4(op, ip, g, bmin, bmax, tMin, tBest, tEnter + g) << g;
+			STATS_BOXES(4);
+		}
+		mask &= stackMask[top];
+		if (!mask) continue;
+
+		if (node.isLeaf()) {
+			STATS_LEAF();
+			for (int r = 0; r < packet.size; r++) {
+				if (!(mask & (1u << r))) continue;
+				if (bUseFaces) {
+					intersectLeafFaces(packet.rays[r], node, tMin, hits[r]);
+				}
+				else if (tEnter[r] < hits[r].t) {
+					hits[r].t = tEnter[r];
+					hits[r].node = i;
+					hits[r].index = nearestLeafPoint(packet.rays[r], node);
+				}
+				tBest[r] = hits[r].t;
+			}
+			continue;
+		}
+		for (int k = 7; k >= 0; k--) {
+			int c = node.child(octantBox[k ^ sign]);
+			if (c < 0) continue;
+			stack[top] = c;
+			stackMask[top++] = mask;
+		}
+		STATS_STACK(top);
+	}
+
+	int count = 0;
+	for (int r = 0; r < packet.size; r++) {
+		if (hits[r].index < 0) continue;
+		count++;
+		if (bUseFaces) {
+			hits[r].point = packet.rays[r].origin + packet.rays[r].direction * hits[r].t;
+		}
+		else {
+			ofVec3f v = view.vertex(hits[r].index);
+			hits[r].point = Vector3(v.x, v.y, v.z);
+		}
+	}
+	return count;
+}
+
+// intersectAll:  collect every hit inside (tMin, tMax), sorted along the ray.
+//                Returns the number of hits.
+//
+int Octree::intersectAll(const Ray &ray, vector<RayHit> & hits, float tMin, float tMax) const {
+	LazyLock lock(*this, [&](const Box & b) { return b.intersect(ray, tMin, tMax); });
+	STATS_QUERY();
+	hits.clear();
+	if (numNodes == 0) return 0;
+
+	int stack[MaxStack];
+	float stackT[MaxStack];
+	int top = 0;
+	if (!nodeData[0].box.intersect(ray, tMin, tMax, stackT[0])) return 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		top--;
+		int i = stack[top];
+		float tEnter = stackT[top];
+		const FlatNode & node = nodeData[i];
+		STATS_NODE();
+		if (node.isLeaf()) {
+			STATS_LEAF();
+			if (bUseFaces) {
+				intersectLeafFaces(ray, node, tMin, tMax, hits);
+			}
+			else {
+				RayHit h;
+				h.t = tEnter;
+				h.node = i;
+				h.index = nearestLeafPoint(ray, node);
+				ofVec3f v = view.vertex(h.index);
+				h.point = Vector3(v.x, v.y, v.z);
+				hits.push_back(h);
+			}
+			continue;
+		}
+		float t[8];
+		int mask = hitChildren(ray, node, tMin, tMax, t);
+		STATS_BOXES(node.numChildren());
+		for (int k = node.numChildren() - 1; k >= 0; k--) {
+			if (!(mask & (1 << k))) continue;
+			stack[top] = node.firstChild + k;
+			stackT[top++] = t[k];
+		}
+		STATS_STACK(top);
+	}
+	std::sort(hits.begin(), hits.end(), [](const RayHit & a, const RayHit & b) { return a.t < b.t; });
+	return hits.size();
+}
+
+// intersectLeafFaces:  test the ray against all the triangles of a leaf and
+//                      keep the closest hit inside (tMin, hit.t).
+//
+bool Octree::intersectLeafFaces(const Ray &ray, const FlatNode & node, float tMin, RayHit & hit) const {
+	const float o[3] = { ray.origin.x(), ray.origin.y(), ray.origin.z() };
+	const float d[3] = { ray.direction.x(), ray.direction.y(), ray.direction.z() };
+	const float *tri[9];
+	for (int k = 0; k < 9; k++) tri[k] = faceCols[k];
+
+	bool found = false;
+	for (int i = node.begin; i < node.end; i += 4) {
+		float t[4], u[4], v[4];
+		int mask = rayTriangles4(o, d, tri, i, tMin, hit.t, t, u, v);
+		if (node.end - i < 4) mask &= (1 << (node.end - i)) - 1;
+		for (int k = 0; mask; k++, mask >>= 1) {
+			if ((mask & 1) && t[k] < hit.t) {
+				hit.t = t[k];
+				hit.u = u[k];
+				hit.v = v[k];
+				hit.index = pointData[i + k];
+				hit.node = &node - nodeData;
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+// nearestLeafPoint:  the point of a point octree leaf that passes closest to
+//                    the ray (the leaf's only point when it holds one)
+//
+int Octree::nearestLeafPoint(const Ray &ray, const FlatNode & node) const {
+	if (node.numPoints() <= 1) return pointData[node.begin];
+	const float o[3] = { ray.origin.x(), ray.origin.y(), ray.origin.z() };
+	const float d[3] = { ray.direction.x(), ray.direction.y(), ray.direction.z() };
+	float invLen2 = 1 / (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+	int nearest = pointData[node.begin];
+	float best = FLT_MAX;
+	for (int i = node.begin; i < node.end; i += 8) {
+		int n = std::min(8, node.end - i);
+		float x[8], y[8], z[8], d2[8];
+		gatherPoints8(view, pointData + i, n, x, y, z);
+		rayPointDist8(x, y, z, o, d, invLen2, d2);
+		for (int j = 0; j < n; j++) {
+			if (d2[j] < best) {
+				best = d2[j];
+				nearest = pointData[i + j];
+			}
+		}
+	}
+	return nearest;
+}
+
+// same, appending every triangle hit inside (tMin, tMax) to "hits"
+//
+void Octree::intersectLeafFaces(const Ray &ray, const FlatNode & node, float tMin, float tMax,
+	vector<RayHit> & hits) const
+{
+	const float o[3] = { ray.origin.x(), ray.origin.y(), ray.origin.z() };
+	const float d[3] = { ray.direction.x(), ray.direction.y(), ray.direction.z() };
+	const float *tri[9];
+	for (int k = 0; k < 9; k++) tri[k] = faceCols[k];
+
+	for (int i = node.begin; i < node.end; i += 4) {
+		float t[4], u[4], v[4];
+		int mask = rayTriangles4(o, d, tri, i, tMin, tMax, t, u, v);
+		if (node.end - i < 4) mask &= (1 << (node.end - i)) - 1;
+		for (int k = 0; mask; k++, mask >>= 1) {
+			if (!(mask & 1)) continue;
+			RayHit h;
+			h.t = t[k];
+			h.u = u[k];
+			h.v = v[k];
+			h.index = pointData[i + k];
+			h.node = &node - nodeData;
+			h.point = ray.origin + ray.direction * h.t;
+			hits.push_back(h);
+		}
+	}
+}
+
+// draw the first numLevels levels of the flat node array (works when the
+// TreeNode tree has been freed)
+//
+void Octree::draw(int numLevels, int level) const {
+	LazyLock lock(*this);
+	if (numNodes == 0) return;
+	int stack[MaxStack];
+	int stackLevel[MaxStack];
+	int top = 0;
+	stack[top] = 0;
+	stackLevel[top++] = level;
+	while (top > 0) {
+		top--;
+		const FlatNode & node = nodeData[stack[top]];
+		int l = stackLevel[top];
+		if (l >= numLevels) continue;
+		ofSetColor(colors[l]);
+		drawBox(node.box);
+		for (int c = node.firstChild + node.numChildren() - 1; c >= node.firstChild; c--) {
+			stack[top] = c;
+			stackLevel[top++] = l + 1;
+		}
+	}
+}
+
+// Optional
+//
+void Octree::drawLeafNodes(TreeNode & node) {
+
+}
+
+
+
+
+
+// subDivideBox8() box that point p falls in for a node centered at c, split
+// the same way as partitionPoints() (classifyOctants())
+//
+static int boxIndex(const ofVec3f & p, const Vector3 & c) {
+	int floor = (p.y >= c.y()) ? 4 : 0;
+	if (p.z >= c.z()) return floor + ((p.x >= c.x()) ? 2 : 3);
+	return floor + ((p.x >= c.x()) ? 1 : 0);
+}
+
+// prepareUpdates:  get ready for insert/remove/refit.  A mapped cache is
+//                  copied into the vectors, interior point runs are dropped
+//                  (only leaf runs are kept up to date) and a face octree
+//                  builds its parent, face and vertex lookup tables.
+//
+void Octree::prepareUpdates() {
+	if (bUpdatesReady || numNodes == 0) return;
+	if (cache) {
+		int numBounds = 0;
+		for (int i = 0; i < numNodes; i++)
+			numBounds = std::max(numBounds, nodeData[i].bounds + 1);
+		int n = numPointData;
+		nodes.assign(nodeData, nodeData + numNodes);
+		childBounds.assign(boundsData, boundsData + numBounds);
+		points.assign(pointData, pointData + n);
+		if (bUseFaces) {
+			for (int k = 0; k < 9; k++) faceData[k].assign(faceCols[k], faceCols[k] + n + 3);
+		}
+		bindArrays();
+	}
+	for (int i = 0; i < nodes.size(); i++) {
+		if (!nodes[i].isLeaf()) nodes[i].begin = nodes[i].end = 0;
+	}
+	if (bUseFaces) {
+		parents.assign(nodes.size(), -1);
+		slotLeaf.assign(points.size(), -1);
+		for (int i = 0; i < nodes.size(); i++) {
+			for (int c = nodes[i].firstChild; c < nodes[i].firstChild + nodes[i].numChildren(); c++)
+				parents[c] = i;
+			if (nodes[i].isLeaf()) {
+				for (int k = nodes[i].begin; k < nodes[i].end; k++) slotLeaf[k] = i;
+			}
+		}
+		faceSlot.assign(points.size(), -1);
+		for (int k = 0; k < points.size(); k++) faceSlot[points[k]] = k;
+		vertexFaceStart.assign(view.numVertices + 1, 0);
+		for (int f = 0; f < points.size(); f++) {
+			for (int k = 0; k < 3; k++) vertexFaceStart[view.faceVertex(f, k) + 1]++;
+		}
+		for (int v = 0; v < view.numVertices; v++) vertexFaceStart[v + 1] += vertexFaceStart[v];
+		vertexFaces.resize(vertexFaceStart.back());
+		vector<int> fill(vertexFaceStart.begin(), vertexFaceStart.end() - 1);
+		for (int f = 0; f < points.size(); f++) {
+			for (int k = 0; k < 3; k++) vertexFaces[fill[view.faceVertex(f, k)]++] = f;
+		}
+	}
+	bUpdatesReady = true;
+}
+
+// loadChildBounds:  (re)write the childBounds entry of node i from its
+//                   children, adding an entry if it doesn't have one
+//
+void Octree::loadChildBounds(int i) {
+	if (nodes[i].bounds < 0) {
+		nodes[i].bounds = childBounds.size();
+		childBounds.push_back(ChildBounds());
+	}
+	ChildBounds & cb = childBounds[nodes[i].bounds];
+	int n = nodes[i].numChildren();
+	for (int a = 0; a < 3; a++) {
+		for (int k = 0; k < 8; k++) {
+			cb.lo[a][k] = k < n ? nodes[nodes[i].firstChild + k].box.parameters[0][a] : FLT_MAX;
+			cb.hi[a][k] = k < n ? nodes[nodes[i].firstChild + k].box.parameters[1][a] : -FLT_MAX;
+		}
+	}
+}
+
+// addChild:  give node i a new, empty leaf child for subDivideBox8() box b.
+//            Children must stay contiguous, so the node's child group is
+//            copied to the end of the array with the new child in place; the
+//            old slots are left unused.  Returns the new child's index.
+//
+int Octree::addChild(int i, int b, const Box & childBox) {
+	vector<FlatNode> group;
+	for (int c = nodes[i].firstChild; c < nodes[i].firstChild + nodes[i].numChildren(); c++)
+		group.push_back(nodes[c]);
+	deadNodes += group.size();
+	unsigned char mask = nodes[i].childMask | (1 << b);
+	int first = nodes.size();
+	int added = -1;
+	for (int k = 0, slot = 0; k < 8; k++) {
+		if (!(mask & (1 << k))) continue;
+		if (k == b) {
+			FlatNode leaf;
+			leaf.box = childBox;
+			added = nodes.size();
+			nodes.push_back(leaf);
+		}
+		else {
+			nodes.push_back(group[slot++]);
+		}
+	}
+	nodes[i].firstChild = first;
+	nodes[i].childMask = mask;
+	loadChildBounds(i);
+	return added;
+}
+
+// removeChild:  unlink child c (a node index) from node i, closing the gap in
+//               its child group
+//
+void Octree::removeChild(int i, int c) {
+	if (nodes[c].isPending()) lazy->pending--;
+	int first = nodes[i].firstChild, n = nodes[i].numChildren();
+	for (int k = 0; k < 8; k++) {
+		if (nodes[i].child(k) == c) {
+			nodes[i].childMask &= ~(1 << k);
+			break;
+		}
+	}
+	for (int j = c; j < first + n - 1; j++)
+		nodes[j] = nodes[j + 1];
+	deadNodes++;
+	if (nodes[i].isLeaf()) {
+		nodes[i].firstChild = -1;
+		nodes[i].begin = nodes[i].end = 0;
+	}
+	else {
+		loadChildBounds(i);
+	}
+}
+
+// collapse:  turn node i back into a leaf when its children are all leaves
+//            holding no more than leafCapacity() points between them, as
+//            subdivide() would never have split it
+//
+bool Octree::collapse(int i) {
+	if (nodes[i].isLeaf()) return false;
+	int n = 0;
+	for (int c = nodes[i].firstChild; c < nodes[i].firstChild + nodes[i].numChildren(); c++) {
+		if (!nodes[c].isLeaf()) return false;
+		n += nodes[c].numPoints();
+	}
+	if (n > leafCapacity()) return false;
+	vector<int> run;
+	for (int c = nodes[i].firstChild; c < nodes[i].firstChild + nodes[i].numChildren(); c++) {
+		run.insert(run.end(), points.begin() + nodes[c].begin, points.begin() + nodes[c].end);
+		if (nodes[c].isPending()) lazy->pending--;
+	}
+	deadNodes += nodes[i].numChildren();
+	deadPoints += run.size();
+	nodes[i].childMask = 0;
+	nodes[i].firstChild = -1;
+	nodes[i].begin = nodes[i].end = 0;
+	for (int k = 0; k < run.size(); k++) appendPoint(i, run[k]);
+	return true;
+}
+
+// appendPoint:  add "index" to the point run of leaf i.  Unless the run is
+//               already at the end of points it is moved there first.
+//
+void Octree::appendPoint(int i, int index) {
+	if (nodes[i].end != points.size() || nodes[i].begin == nodes[i].end) {
+		int begin = points.size();
+		for (int k = nodes[i].begin; k < nodes[i].end; k++) points.push_back(points[k]);
+		deadPoints += nodes[i].numPoints();
+		nodes[i].begin = begin;
+	}
+	points.push_back(index);
+	nodes[i].end = points.size();
+}
+
+// insertPoint:  add point "index" below node i (at "level"), splitting a full
+//               leaf the way subdivide() would have.  A pending node of a
+//               lazy octree just takes the point; it is split when expanded.
+//
+void Octree::insertPoint(int i, int level, int index) {
+	ofVec3f p = view.vertex(index);
+	while (!nodes[i].isLeaf()) {
+		int b = boxIndex(p, nodes[i].box.center());
+		int c = nodes[i].child(b);
+		if (c < 0) {
+			Box box[8];
+			subDivideBox8(nodes[i].box, box);
+			appendPoint(addChild(i, b, box[b]), index);
+			return;
+		}
+		i = c;
+		level++;
+	}
+	if (nodes[i].numPoints() < leafCapacity() || !canSplit(nodes[i].box, level, levels) || nodes[i].isPending()) {
+		appendPoint(i, index);
+		return;
+	}
+
+	// split the leaf: its points and the new one go to new children
+	//
+	vector<int> run(points.begin() + nodes[i].begin, points.begin() + nodes[i].end);
+	run.push_back(index);
+	deadPoints += nodes[i].numPoints();
+	nodes[i].begin = nodes[i].end = 0;
+	Box box[8];
+	subDivideBox8(nodes[i].box, box);
+	for (int k = 0; k < run.size(); k++) {
+		int b = boxIndex(view.vertex(run[k]), nodes[i].box.center());
+		int c = nodes[i].child(b);
+		if (c < 0)
+			appendPoint(addChild(i, b, box[b]), run[k]);
+		else
+			insertPoint(c, level + 1, run[k]);
+	}
+}
+
+// insert:  add mesh vertex "index" (at its current position in "mesh") to a
+//          point octree.  Fails if it lies outside the root box.
+//
+bool Octree::insert(int index) {
+	if (bUseFaces || numNodes == 0) return false;
+	ofVec3f p = view.vertex(index);
+	if (!nodeData[0].box.inside(Vector3(p.x, p.y, p.z))) return false;
+	prepareUpdates();
+	insertPoint(0, 1, index);
+	compact();
+	bindArrays();
+	return true;
+}
+
+// remove:  take mesh vertex "index" (found at its current position in
+//          "mesh") out of a point octree.  Leaves and interior nodes left
+//          empty are unlinked from their parents, and nodes that no longer
+//          need to be split are collapsed.
+//
+bool Octree::remove(int index) {
+	if (bUseFaces || numNodes == 0) return false;
+	prepareUpdates();
+	ofVec3f p = view.vertex(index);
+	int path[64];
+	int depth = 0;
+	path[0] = 0;
+	while (!nodes[path[depth]].isLeaf()) {
+		int c = nodes[path[depth]].child(boxIndex(p, nodes[path[depth]].box.center()));
+		if (c < 0 || depth == 63) return false;
+		path[++depth] = c;
+	}
+
+	FlatNode & leaf = nodes[path[depth]];
+	int k = leaf.begin;
+	while (k < leaf.end && points[k] != index) k++;
+	if (k == leaf.end) return false;
+	points[k] = points[leaf.end - 1];
+	leaf.end--;
+	deadPoints++;
+	for (; depth > 0 && nodes[path[depth]].isLeaf() && nodes[path[depth]].numPoints() == 0; depth--)
+		removeChild(path[depth - 1], path[depth]);
+	if (nodes[path[depth]].isLeaf()) depth--;
+	for (; depth >= 0 && collapse(path[depth]); depth--);
+	compact();
+	bindArrays();
+	return true;
+}
+
+// compact:  once more than half the nodes or points slots are unused, copy
+//           the nodes reachable from the root (breadth first, as flatten()
+//           lays them out) and their point runs into new arrays.  Only the
+//           point octree updates leave slots unused.
+//
+void Octree::compact() {
+	if (2 * deadNodes <= (int)nodes.size() && 2 * deadPoints <= (int)points.size()) return;
+	vector<FlatNode> newNodes;
+	vector<ChildBounds> newBounds;
+	vector<int> newPoints;
+	newNodes.reserve(nodes.size() - deadNodes);
+	newPoints.reserve(points.size() - deadPoints);
+	vector<int> from(1, 0);				// old index of each new node
+	newNodes.push_back(nodes[0]);
+	for (int j = 0; j < newNodes.size(); j++) {
+		const FlatNode & old = nodes[from[j]];
+		FlatNode node = old;
+		node.begin = newPoints.size();
+		newPoints.insert(newPoints.end(), points.begin() + old.begin, points.begin() + old.end);
+		node.end = newPoints.size();
+		if (!old.isPending()) node.bounds = -1;
+		if (!old.isLeaf()) {
+			node.firstChild = newNodes.size();
+			node.bounds = newBounds.size();
+			newBounds.push_back(childBounds[old.bounds]);
+			for (int k = 0; k < old.numChildren(); k++) {
+				newNodes.push_back(nodes[old.firstChild + k]);
+				from.push_back(old.firstChild + k);
+			}
+		}
+		newNodes[j] = node;
+	}
+	nodes.swap(newNodes);
+	childBounds.swap(newBounds);
+	points.swap(newPoints);
+	deadNodes = deadPoints = 0;
+	bindArrays();
+}
+
+// refit:  recompute the boxes of a face octree on the paths from "leaves" up
+//         to the root.  Children always come after their parent in the
+//         array, so going from high to low index refits children first.
+//
+void Octree::refit(const vector<int> & leaves) {
+	if (!bUseFaces || numNodes == 0) return;
+	prepareUpdates();
+	vector<int> dirty;
+	for (int i = 0; i < leaves.size(); i++) {
+		for (int n = leaves[i]; n >= 0; n = parents[n]) dirty.push_back(n);
+	}
+	std::sort(dirty.begin(), dirty.end(), std::greater<int>());
+	dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+	for (int j = 0; j < dirty.size(); j++) {
+		int i = dirty[j];
+		ofVec3f lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		auto grow = [&](const ofVec3f & a, const ofVec3f & b) {
+			lo.x = std::min(lo.x, a.x); lo.y = std::min(lo.y, a.y); lo.z = std::min(lo.z, a.z);
+			hi.x = std::max(hi.x, b.x); hi.y = std::max(hi.y, b.y); hi.z = std::max(hi.z, b.z);
+		};
+		if (nodes[i].isLeaf()) {
+			for (int k = nodes[i].begin; k < nodes[i].end; k++) {
+				for (int v = 0; v < 3; v++) {
+					ofVec3f p = view.vertex(view.faceVertex(points[k], v));
+					grow(p, p);
+				}
+			}
+		}
+		else {
+			loadChildBounds(i);
+			for (int c = nodes[i].firstChild; c < nodes[i].firstChild + nodes[i].numChildren(); c++) {
+				const Box & b = nodes[c].box;
+				grow(ofVec3f(b.min().x(), b.min().y(), b.min().z()), ofVec3f(b.max().x(), b.max().y(), b.max().z()));
+			}
+		}
+		nodes[i].box = Box(Vector3(lo.x, lo.y, lo.z), Vector3(hi.x, hi.y, hi.z));
+	}
+	root.box = nodes[0].box;
+	bindArrays();
+}
+
+// moveVertices:  move the mesh vertices verts[i] to pos[i] and update the
+//                octree.  Returns false if a point moved outside the root
+//                box of a point octree, or was not in the tree to start
+//                with (either way it is left out of the tree), or if a
+//                point octree reads the caller's arrays (nothing is
+//                changed; see setVertex()).
+//
+bool Octree::moveVertices(const vector<int> & verts, const vector<ofVec3f> & pos) {
+	if (numNodes == 0) return false;
+	if (!bUseFaces && packed.empty() && mesh.getNumVertices() == 0) return false;
+	prepareUpdates();
+	bool ok = true;
+	if (!bUseFaces) {
+		for (int i = 0; i < verts.size(); i++) {
+			bool removed = remove(verts[i]);
+			setVertex(verts[i], pos[i]);
+			ok = removed && insert(verts[i]) && ok;
+		}
+		return ok;
+	}
+
+	vector<int> leaves;
+	for (int i = 0; i < verts.size(); i++)
+		setVertex(verts[i], pos[i]);
+	for (int i = 0; i < verts.size(); i++) {
+		for (int k = vertexFaceStart[verts[i]]; k < vertexFaceStart[verts[i] + 1]; k++) {
+			int slot = faceSlot[vertexFaces[k]];
+			loadFace(slot);
+			leaves.push_back(slotLeaf[slot]);
+		}
+	}
+	refit(leaves);
+	return ok;
+}
+
+// CompactOctree.  Quantized values are decoded with the same functions that
+// encode them, and the ends of the range (0 and the max) decode to the exact
+// ends of the box, so a child touching its parent's side keeps the parent's
+// margin all the way down.
+//
+static inline float dequant8(int q, float lo, float hi, float step) {
+	return q == 255 ? hi : lo + q * step;
+}
+
+static inline float dequant16(int q, float lo, float hi, float step) {
+	return q == 65535 ? hi : lo + q * step;
+}
+
+// smallest q that decodes at or below v
+//
+static unsigned char quantizeLo(float v, float lo, float hi) {
+	float step = (hi - lo) * (1.0f / 255);
+	if (!(step > 0)) return 0;
+	int q = std::min(255, std::max(0, (int)floorf((v - lo) / step)));
+	while (q > 0 && dequant8(q, lo, hi, step) > v) q--;
+	return q;
+}
+
+// largest q that decodes at or above v
+//
+static unsigned char quantizeHi(float v, float lo, float hi) {
+	float step = (hi - lo) * (1.0f / 255);
+	if (!(step > 0)) return 255;
+	int q = std::min(255, std::max(0, (int)ceilf((v - lo) / step)));
+	while (q < 255 && dequant8(q, lo, hi, step) < v) q++;
+	return q;
+}
+
+// decode the boxes of all 8 child slots from the node's own box (lo, hi).
+// Unused slots decode to inside-out boxes; callers mask them off with
+// numChildren.
+//
+static inline void decodeChildren(const QuantBounds & qb, const float lo[3], const float hi[3],
+	float cLo[3][8], float cHi[3][8])
+{
+	for (int a = 0; a < 3; a++) {
+		float step = (hi[a] - lo[a]) * (1.0f / 255);
+		for (int k = 0; k < 8; k++) {
+			cLo[a][k] = dequant8(qb.lo[a][k], lo[a], hi[a], step);
+			cHi[a][k] = dequant8(qb.hi[a][k], lo[a], hi[a], step);
+		}
+	}
+}
+
+// decoded position of points[i], in the leaf box (lo, hi)
+//
+static inline void decodePoint(const unsigned short *q, const float lo[3], const float hi[3], float p[3]) {
+	for (int a = 0; a < 3; a++)
+		p[a] = dequant16(q[a], lo[a], hi[a], (hi[a] - lo[a]) * (1.0f / 65535));
+}
+
+// create:  quantize a built (or loaded) octree.  The nodes keep their indices;
+//          boxes are decoded top down while encoding so that each child is
+//          quantized against the box the queries will see for its parent.
+//
+void CompactOctree::create(const Octree & tree) {
+	bUseFaces = tree.bUseFaces;
+	nodes.assign(tree.numNodes, CompactNode());
+	bounds.clear();
+	points.clear();
+	pointOffsets.clear();
+	for (int k = 0; k < 9; k++) faceData[k].clear();
+	if (tree.numNodes == 0) return;
+
+	int numPoints = 0;
+	for (int i = 0; i < tree.numNodes; i++)
+		numPoints = std::max(numPoints, tree.nodeData[i].end);
+	points.assign(tree.pointData, tree.pointData + numPoints);
+	if (bUseFaces) {
+		for (int k = 0; k < 9; k++) faceData[k].assign(tree.faceCols[k], tree.faceCols[k] + numPoints);
+	}
+	else pointOffsets.resize(numPoints * 3, 0);
+
+	// grow the root by more than the few ulps a child box can stick out of
+	// its parent
+	//
+	vector<float> box(tree.numNodes * 6);
+	const Box & r = tree.nodeData[0].box;
+	for (int a = 0; a < 3; a++) {
+		float lo = r.parameters[0][a], hi = r.parameters[1][a];
+		float margin = (hi - lo + fabsf(lo) + fabsf(hi)) * 1e-5f;
+		box[a] = lo - margin;
+		box[3 + a] = hi + margin;
+	}
+	rootBox = Box(Vector3(box[0], box[1], box[2]), Vector3(box[3], box[4], box[5]));
+
+	// walk the nodes reachable from the root, parents before children
+	//
+	vector<int> open(1, 0);
+	for (int next = 0; next < open.size(); next++) {
+		int i = open[next];
+		const FlatNode & f = tree.nodeData[i];
+		CompactNode & c = nodes[i];
+		c.firstChild = f.firstChild;
+		c.begin = f.begin;
+		c.end = f.end;
+		const float *lo = &box[i * 6], *hi = lo + 3;
+		if (f.isLeaf()) {
+			if (bUseFaces) continue;
+			for (int s = f.begin; s < f.end; s++) {
+				ofVec3f v = tree.view.vertex(points[s]);
+				for (int a = 0; a < 3; a++) {
+					float step = (hi[a] - lo[a]) * (1.0f / 65535);
+					int q = step > 0 ? (int)roundf((v[a] - lo[a]) / step) : 0;
+					pointOffsets[s * 3 + a] = std::min(65535, std::max(0, q));
+				}
+			}
+			continue;
+		}
+
+		QuantBounds qb;
+		qb.numChildren = f.numChildren();
+		memset(qb.lo, 255, sizeof(qb.lo));
+		memset(qb.hi, 0, sizeof(qb.hi));
+		for (int k = 0; k < qb.numChildren; k++) {
+			int child = f.firstChild + k;
+			const Box & b = tree.nodeData[child].box;
+			float *cLo = &box[child * 6], *cHi = cLo + 3;
+			for (int a = 0; a < 3; a++) {
+				float step = (hi[a] - lo[a]) * (1.0f / 255);
+				qb.lo[a][k] = quantizeLo(b.parameters[0][a], lo[a], hi[a]);
+				qb.hi[a][k] = quantizeHi(b.parameters[1][a], lo[a], hi[a]);
+				cLo[a] = dequant8(qb.lo[a][k], lo[a], hi[a], step);
+				cHi[a] = dequant8(qb.hi[a][k], lo[a], hi[a], step);
+			}
+			open.push_back(child);
+		}
+		c.bounds = bounds.size();
+		bounds.push_back(qb);
+	}
+	cout << "Compact octree memory: " << memoryUsage() / 1024 << "KB" << endl;
+}
+
+size_t CompactOctree::memoryUsage() const {
+	return nodes.capacity() * sizeof(CompactNode) + bounds.capacity() * sizeof(QuantBounds) +
+		points.capacity() * sizeof(int) + pointOffsets.capacity() * sizeof(unsigned short) +
+		faceData[0].capacity() * sizeof(float) * 9;
+}
+
+// the traversals below are those of the same Octree queries, with each
+// node's decoded box carried on the stack
+//
+bool CompactOctree::intersect(const Ray &ray, RayHit & hit, float tMin, float tMax) const {
+	hit = RayHit();
+	hit.t = tMax;
+	if (nodes.empty()) return false;
+
+	const float o[3] = { ray.origin.x(), ray.origin.y(), ray.origin.z() };
+	const float inv[3] = { ray.inv_direction.x(), ray.inv_direction.y(), ray.inv_direction.z() };
+	const float d[3] = { ray.direction.x(), ray.direction.y(), ray.direction.z() };
+	const float *tri[9];
+	for (int k = 0; k < 9; k++) tri[k] = faceData[k].data();
+
+	int stack[MaxStack];
+	float stackT[MaxStack];
+	float stackBox[MaxStack][6];
+	float hitBox[6];
+	int top = 0;
+	if (!rootBox.intersect(ray, tMin, tMax, stackT[0])) return false;
+	for (int a = 0; a < 3; a++) {
+		stackBox[0][a] = rootBox.parameters[0][a];
+		stackBox[0][3 + a] = rootBox.parameters[1][a];
+	}
+	stack[top++] = 0;
+	while (top > 0) {
+		top--;
+		if (stackT[top] >= hit.t) continue;
+		int i = stack[top];
+		const CompactNode & node = nodes[i];
+		if (node.isLeaf()) {
+			if (bUseFaces) {
+				for (int s = node.begin; s < node.end; s += 4) {
+					float t[4], u[4], v[4];
+					int mask = rayTriangles4(o, d, tri, s, tMin, hit.t, t, u, v);
+					if (node.end - s < 4) mask &= (1 << (node.end - s)) - 1;
+					for (int k = 0; mask; k++, mask >>= 1) {
+						if ((mask & 1) && t[k] < hit.t) {
+							hit.t = t[k];
+							hit.u = u[k];
+							hit.v = v[k];
+							hit.index = points[s + k];
+							hit.node = i;
+						}
+					}
+				}
+			}
+			else if (node.end > node.begin) {
+				hit.t = stackT[top];
+				hit.node = i;
+				hit.index = points[node.begin];
+				memcpy(hitBox, stackBox[top], sizeof(hitBox));
+			}
+			continue;
+		}
+
+		const QuantBounds & qb = bounds[node.bounds];
+		float cLo[3][8], cHi[3][8], t[8];
+		decodeChildren(qb, stackBox[top], stackBox[top] + 3, cLo, cHi);
+		int mask = slabTest8(o, inv, ray.sign, cLo, cHi, tMin, hit.t, t) & ((1 << qb.numChildren) - 1);
+
+		// push far to near so the nearest child comes off the stack first
+		//
+		int child[8];
+		int n = 0;
+		for (int k = 0; mask; k++, mask >>= 1) {
+			if (!(mask & 1)) continue;
+			int j = n++;
+			for (; j > 0 && t[child[j - 1]] < t[k]; j--) child[j] = child[j - 1];
+			child[j] = k;
+		}
+		for (int m = 0; m < n; m++) {
+			int k = child[m];
+			stack[top] = node.firstChild + k;
+			stackT[top] = t[k];
+			for (int a = 0; a < 3; a++) {
+				stackBox[top][a] = cLo[a][k];
+				stackBox[top][3 + a] = cHi[a][k];
+			}
+			top++;
+		}
+	}
+	if (hit.index < 0) return false;
+	if (bUseFaces) {
+		hit.point = ray.origin + ray.direction * hit.t;
+	}
+	else {
+		// the leaf point passing closest to the ray, as Octree::nearestLeafPoint()
+		//
+		const CompactNode & leaf = nodes[hit.node];
+		float invLen2 = 1 / (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		float best = FLT_MAX;
+		for (int s = leaf.begin; s < leaf.end; s++) {
+			float p[3], v[3];
+			decodePoint(&pointOffsets[s * 3], hitBox, hitBox + 3, p);
+			for (int a = 0; a < 3; a++) v[a] = p[a] - o[a];
+			float t = std::max(0.0f, (v[0] * d[0] + v[1] * d[1] + v[2] * d[2]) * invLen2);
+			for (int a = 0; a < 3; a++) v[a] -= t * d[a];
+			float d2 = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+			if (d2 < best) {
+				best = d2;
+				hit.index = points[s];
+				hit.point = Vector3(p[0], p[1], p[2]);
+			}
+		}
+	}
+	return true;
+}
+
+bool CompactOctree::intersectAny(const Box &box) const {
+	if (nodes.empty() || !rootBox.overlap(box)) return false;
+
+	const float bmin[3] = { box.parameters[0].x(), box.parameters[0].y(), box.parameters[0].z() };
+	const float bmax[3] = { box.parameters[1].x(), box.parameters[1].y(), box.parameters[1].z() };
+	int stack[MaxStack];
+	float stackBox[MaxStack][6];
+	int top = 0;
+	for (int a = 0; a < 3; a++) {
+		stackBox[0][a] = rootBox.parameters[0][a];
+		stackBox[0][3 + a] = rootBox.parameters[1][a];
+	}
+	stack[top++] = 0;
+	while (top > 0) {
+		top--;
+		const CompactNode & node = nodes[stack[top]];
+		if (node.isLeaf()) return true;
+		const QuantBounds & qb = bounds[node.bounds];
+		float cLo[3][8], cHi[3][8];
+		decodeChildren(qb, stackBox[top], stackBox[top] + 3, cLo, cHi);
+		int mask = overlap8(cLo, cHi, bmin, bmax) & ((1 << qb.numChildren) - 1);
+		for (int k = qb.numChildren - 1; k >= 0; k--) {
+			if (!(mask & (1 << k))) continue;
+			stack[top] = node.firstChild + k;
+			for (int a = 0; a < 3; a++) {
+				stackBox[top][a] = cLo[a][k];
+				stackBox[top][3 + a] = cHi[a][k];
+			}
+			top++;
+		}
+	}
+	return false;
+}
+
+bool CompactOctree::intersectTop(const Box &box, float & topRtn) const {
+	if (nodes.empty() || !rootBox.overlap(box)) return false;
+
+	const float bmin[3] = { box.parameters[0].x(), box.parameters[0].y(), box.parameters[0].z() };
+	const float bmax[3] = { box.parameters[1].x(), box.parameters[1].y(), box.parameters[1].z() };
+	bool found = false;
+	float best = -FLT_MAX;
+	int stack[MaxStack];
+	float stackBox[MaxStack][6];
+	int top = 0;
+	for (int a = 0; a < 3; a++) {
+		stackBox[0][a] = rootBox.parameters[0][a];
+		stackBox[0][3 + a] = rootBox.parameters[1][a];
+	}
+	stack[top++] = 0;
+	while (top > 0) {
+		top--;
+		float nodeTop = stackBox[top][4];
+		if (found && nodeTop <= best) continue;
+		const CompactNode & node = nodes[stack[top]];
+		if (node.isLeaf()) {
+			best = nodeTop;
+			found = true;
+			continue;
+		}
+		const QuantBounds & qb = bounds[node.bounds];
+		float cLo[3][8], cHi[3][8];
+		decodeChildren(qb, stackBox[top], stackBox[top] + 3, cLo, cHi);
+		int mask = overlap8(cLo, cHi, bmin, bmax) & ((1 << qb.numChildren) - 1);
+
+		// push lowest first so the highest child comes off the stack first
+		//
+		int child[8];
+		int n = 0;
+		for (int k = 0; mask; k++, mask >>= 1) {
+			if (!(mask & 1) || (found && cHi[1][k] <= best)) continue;
+			int j = n++;
+			for (; j > 0 && cHi[1][child[j - 1]] > cHi[1][k]; j--) child[j] = child[j - 1];
+			child[j] = k;
+		}
+		for (int m = 0; m < n; m++) {
+			int k = child[m];
+			stack[top] = node.firstChild + k;
+			for (int a = 0; a < 3; a++) {
+				stackBox[top][a] = cLo[a][k];
+				stackBox[top][3 + a] = cHi[a][k];
+			}
+			top++;
+		}
+	}
+	if (found) topRtn = best;
+	return found;
+}
+
+int CompactOctree::withinRadius(const ofVec3f & p, float r, vector<PointHit> & hits) const {
+	hits.clear();
+	if (nodes.empty() || bUseFaces) return 0;
+	const float q[3] = { p.x, p.y, p.z };
+	if (boxDist2(rootBox, q) > r * r) return 0;
+
+	int stack[MaxStack];
+	float stackBox[MaxStack][6];
+	int top = 0;
+	for (int a = 0; a < 3; a++) {
+		stackBox[0][a] = rootBox.parameters[0][a];
+		stackBox[0][3 + a] = rootBox.parameters[1][a];
+	}
+	stack[top++] = 0;
+	while (top > 0) {
+		top--;
+		const CompactNode & node = nodes[stack[top]];
+		const float *lo = stackBox[top], *hi = lo + 3;
+		if (node.isLeaf()) {
+			// allow for the rounding of the decoded points
+			//
+			float err2 = 0;
+			for (int a = 0; a < 3; a++) {
+				float e = (hi[a] - lo[a]) * (0.5f / 65535);
+				err2 += e * e;
+			}
+			float rr = r + sqrtf(err2);
+			for (int s = node.begin; s < node.end; s++) {
+				float v[3];
+				decodePoint(&pointOffsets[s * 3], lo, hi, v);
+				float d2 = (v[0] - q[0]) * (v[0] - q[0]) + (v[1] - q[1]) * (v[1] - q[1]) + (v[2] - q[2]) * (v[2] - q[2]);
+				if (d2 > rr * rr) continue;
+				PointHit h;
+				h.index = points[s];
+				h.dist = sqrtf(d2);
+				hits.push_back(h);
+			}
+			continue;
+		}
+		const QuantBounds & qb = bounds[node.bounds];
+		float cLo[3][8], cHi[3][8], d2[8];
+		decodeChildren(qb, lo, hi, cLo, cHi);
+		boxDist8(cLo, cHi, q, d2);
+		for (int k = qb.numChildren - 1; k >= 0; k--) {
+			if (d2[k] > r * r) continue;
+			stack[top] = node.firstChild + k;
+			for (int a = 0; a < 3; a++) {
+				stackBox[top][a] = cLo[a][k];
+				stackBox[top][3 + a] = cHi[a][k];
+			}
+			top++;
+		}
+	}
+	return hits.size();
+}
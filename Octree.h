@@ -12,42 +12,359 @@
 #include "ofMain.h"
 #include "box.h"
 #include "ray.h"
+#include "SpatialIndex.h"
+#include "Frustum.h"
+#include <float.h>
+#include <limits.h>
+#include <stdint.h>
 
 
 
+//  The points of a node are the run [begin, end) of Octree::points, which is
+//  ordered so that every node's points are contiguous.  In a face octree the
+//  "points" are triangle indices.
+//
 class TreeNode {
 public:
 	Box box;
-	vector<int> points;
+	int begin = 0, end = 0;
 	vector<TreeNode> children;
+	int octant = 0;		// index of this node's box in parent's subDivideBox8() list
+
+	int numPoints() const { return end - begin; }
 };
 
-class Octree {
+//  Flat, pointer-free node layout used by the query functions.  All nodes live
+//  in one array (Octree::nodes) in breadth-first order.  The children of a node
+//  are stored next to each other starting at firstChild; bit i of childMask is
+//  set when the child for subDivideBox8() box i is present.
+//
+class FlatNode {
 public:
-	
-	void create(const ofMesh & mesh, int numLevels);
-	void subdivide(const ofMesh & mesh, TreeNode & node, int numLevels, int level);
-	bool intersect(const Ray &, const TreeNode & node, TreeNode & nodeRtn);
-	bool intersect(const Box &, TreeNode & node, vector<Box> & boxListRtn);
-	void draw(TreeNode & node, int numLevels, int level);
-	void draw(int numLevels, int level) {
-		draw(root, numLevels, level);
+	Box box;
+	int firstChild = -1;
+	int begin = 0, end = 0;	// run of Octree::points in this node
+	int bounds = -1;		// interior node: its children's boxes in Octree::childBounds;
+							// unexpanded node of a lazy octree: -2 - its cell (see LazyNodes)
+	unsigned char childMask = 0;
+
+	bool isLeaf() const { return childMask == 0; }
+	bool isPending() const { return bounds < -1; }
+	int pendingCell() const { return -2 - bounds; }
+	int numPoints() const { return end - begin; }
+	int numChildren() const {
+		int n = 0;
+		for (unsigned char m = childMask; m; m &= m - 1) n++;
+		return n;
+	}
+	// index of the child for subDivideBox8() box i, -1 if there is none
+	int child(int i) const {
+		if (!(childMask & (1 << i))) return -1;
+		int n = 0;
+		for (unsigned char m = childMask & ((1 << i) - 1); m; m &= m - 1) n++;
+		return firstChild + n;
+	}
+};
+
+//  Boxes of the children of an interior node, SoA, so that a ray or box is
+//  tested against all of them with one kernel (slabTest8, overlap8).  Slot k
+//  is the node's k-th child, firstChild + k; unused slots are empty boxes.
+//
+class ChildBounds {
+public:
+	float lo[3][8];
+	float hi[3][8];
+};
+
+//  Up to 16 rays traced through the octree together.  The origins and inverse
+//  directions are kept SoA so the node tests run four rays at a time.
+//
+class RayPacket {
+public:
+	static const int MaxRays = 16;
+
+	void clear() { size = 0; }
+	bool add(const Ray & ray) {
+		if (size == MaxRays) return false;
+		rays[size] = ray;
+		for (int a = 0; a < 3; a++) {
+			origin[a][size] = ray.origin[a];
+			invDir[a][size] = ray.inv_direction[a];
+		}
+		size++;
+		return true;
+	}
+
+	int size = 0;
+	Ray rays[MaxRays];
+	float origin[3][MaxRays];
+	float invDir[3][MaxRays];
+};
+
+//  Traversal counters of the calling thread, summed over the queries run since
+//  the last Octree::resetStats().  "Box tests" are child boxes tested against
+//  the ray or box (slab, overlap or distance tests).  The queries only count
+//  when OCTREE_STATS is nonzero; build with OCTREE_STATS=0 to compile the
+//  counting out.
+//
+#ifndef OCTREE_STATS
+#define OCTREE_STATS 1
+#endif
+
+class OctreeStats {
+public:
+	uint64_t queries = 0;
+	uint64_t nodesVisited = 0;
+	uint64_t boxTests = 0;
+	uint64_t leavesReached = 0;
+	uint64_t stackDepthSum = 0;	// sum of the deepest stack (knn: queue) of each query
+	int maxStackDepth = 0;		// deepest stack of any query
+	int queryDepth = 0;			// deepest stack of the current query
+
+	void print() const;
+};
+
+class MappedFile;
+class LazyNodes;
+
+class Octree : public SpatialIndex {
+public:
+	enum BuildMethod { BuildTopDown, BuildMorton };
+
+	// create(ofMesh) keeps a copy of the mesh; create(MeshView) indexes the
+	// caller's arrays in place (see MeshView) and with bPackVertices keeps
+	// just the vertex positions, packed x, y, z.
+	//
+	void create(const ofMesh & mesh, int numLevels, int numThreads = 1);
+	void create(const MeshView & mesh, int numLevels, int numThreads = 1);
+	void setMesh(const MeshView & mesh);
+	bool setVertex(int i, const ofVec3f & p);
+	void build(const ofMesh & mesh, int numThreads = 1);
+	const char *name() const {
+		if (bLazy) return bUseFaces ? "lazy face octree" : "lazy octree";
+		return bUseFaces ? "face octree" : "octree";
 	}
+	void subdivide(TreeNode & node, int numLevels, int level) const;
+	void subdivide(TreeNode & node, int numLevels, int level, int & leafCount) const;
+	void subdivideParallel(int numLevels, int level, int numThreads);
+	int splitNode(TreeNode & node) const;
+	void partitionPoints(const Vector3 & center, int begin, int end, int split[9]) const;
+	void loadBuildCoords(int begin, int end) const;
+	void freeBuildCoords() const;
+	void dropInteriorPoints(TreeNode & node) const;
+	int leafCapacity() const { return bUseFaces ? maxLeafFaces : maxLeafPoints; }
+	bool canSplit(const Box & box, int level, int numLevels) const;
+	void refitFaceBoxes(TreeNode & node) const;
+	void loadFaceData();
+	void loadFace(int i) const;
+	size_t memoryUsage() const;
+	size_t meshMemoryUsage() const;
+	void printReport() const;
+	static OctreeStats & stats();
+	static void resetStats();
+	static void benchmarkBuild(const ofMesh & mesh, int numLevels, int maxThreads);
+	static void benchmarkLeafCapacity(const ofMesh & mesh, int numLevels, float minCellSize = 0);
+	void buildMorton(int numLevels);
+	bool intersect(const Ray &, const TreeNode & node, const TreeNode *& nodeRtn) const;
+	bool intersect(const Box &, const TreeNode & node, vector<Box> & boxListRtn) const;
+
+	// same queries over the flat node array (no recursion)
+	//
+	void flatten();
+	void flatten(const TreeNode & t, int node) const;
+	void bindArrays();
+	void bindVectors() const;
+	bool intersect(const Ray &, int & nodeRtn) const;
+	bool intersect(const Box &, vector<Box> & boxListRtn) const;
+	bool intersectAny(const Box &, int maxDepth = INT_MAX) const;
+	bool intersectTop(const Box &, float & topRtn, int maxDepth = INT_MAX) const;
+	int countInBox(const Box &, int maxDepth = INT_MAX) const;
+	bool intersectSwept(const Box &, const Vector3 & move, RayHit & hit) const;
+	int intersect(const Box &, vector<PointSpan> & spans) const;
+	int intersect(const Frustum &, int level, vector<int> & nodesRtn) const;
+	bool intersect(const Ray &, RayHit & hit, float tMin = 0, float tMax = FLT_MAX) const;
+	int intersectAll(const Ray &, vector<RayHit> & hits, float tMin = 0, float tMax = FLT_MAX) const;
+	bool intersectLeafFaces(const Ray &, const FlatNode & node, float tMin, RayHit & hit) const;
+	int nearestLeafPoint(const Ray &, const FlatNode & node) const;
+	void intersectLeafFaces(const Ray &, const FlatNode & node, float tMin, float tMax, vector<RayHit> & hits) const;
+	int intersect(const RayPacket &, RayHit hits[], float tMin = 0, float tMax = FLT_MAX) const;
+	int hitChildren(const Ray &, const FlatNode & node, float tMin, float tMax, float tRtn[8]) const;
+	int knn(const ofVec3f & p, int k, vector<PointHit> & hits) const;
+	int knn(const ofVec3f & p, int k, vector<PointHit> & hits, QueryContext & context) const;
+	int withinRadius(const ofVec3f & p, float r, vector<PointHit> & hits) const;
+	int getPointsInBox(const Box & box, vector<int> & pointsRtn) const;
+	int getPointsInBox(const Box & box, vector<int> & pointsRtn, QueryContext & context) const;
+	int orderChildren(const Ray &, const FlatNode & node, float tMin, float tMax, int childRtn[8], float tRtn[8]) const;
+	void draw(TreeNode & node, int numLevels, int level);
+	void draw(int numLevels, int level) const;
 	void drawLeafNodes(TreeNode & node);
 	static void drawBox(const Box &box);
-	static Box meshBounds(const ofMesh &);
-	int getMeshPointsInBox(const ofMesh &mesh, const vector<int> & points, Box & box, vector<int> & pointsRtn);
-	int getMeshFacesInBox(const ofMesh &mesh, const vector<int> & faces, Box & box, vector<int> & facesRtn);
-	void subDivideBox8(const Box &b, vector<Box> & boxList);
+	static Box meshBounds(const MeshView &);
+	int getMeshPointsInBox(const MeshView &mesh, const vector<int> & points, Box & box, vector<int> & pointsRtn);
+	int getMeshFacesInBox(const MeshView &mesh, const vector<int> & faces, Box & box, vector<int> & facesRtn);
+	void subDivideBox8(const Box &b, vector<Box> & boxList) const;
+	void subDivideBox8(const Box &b, Box boxList[8]) const;
+
+	// binary cache of the flat arrays; a loaded cache is memory-mapped
+	// read-only and queried in place
+	//
+	bool save(const string & path) const;
+	bool load(const string & path, const ofMesh & mesh, int numLevels);
+	bool load(const string & path, const MeshView & mesh, int numLevels);
+	void createCached(const string & path, const ofMesh & mesh, int numLevels, int numThreads = 1);
+	void createCached(const string & path, const MeshView & mesh, int numLevels, int numThreads = 1);
+	static uint64_t meshHash(const MeshView & mesh);
+
+	// incremental updates for a deforming mesh (craters).  Points move
+	// between leaves of a point octree; a face octree keeps each face in its
+	// leaf and refits the boxes on the path to the root.  Only the flat
+	// arrays are updated, not the TreeNode tree.  An octree on the caller's
+	// arrays doesn't write them: store the new positions there before
+	// moveVertices().  A point octree finds a point by its old position, so
+	// it has to keep its own (the mesh copy or bPackVertices) to be updated.
+	// Moved child groups and point runs leave their old slots unused; the
+	// arrays are compacted once more than half of either is unused.
+	//
+	bool insert(int index);
+	bool remove(int index);
+	void refit(const vector<int> & leaves);
+	bool moveVertices(const vector<int> & verts, const vector<ofVec3f> & pos);
+	void prepareUpdates();
+	void insertPoint(int node, int level, int index);
+	void appendPoint(int node, int index);
+	int addChild(int node, int box, const Box & childBox);
+	void removeChild(int node, int child);
+	bool collapse(int node);
+	void loadChildBounds(int node);
+	void compact();
 
-	ofMesh mesh;
+	// lazy subdivision.  With bLazy, create() builds only the first
+	// prebuiltLevels levels below the root; a node there that would be
+	// split further is left as a pending leaf holding all its points.  A
+	// query that reaches a pending node first expands it (its whole
+	// subtree, as create() would have built it), so the answers are those
+	// of the full tree, and only the cells that are queried are ever built.
+	// The frustum query and draw() take pending nodes as leaves.  Nodes are
+	// expanded once, under an exclusive lock; until every cell is expanded,
+	// queries hold a shared lock.  Only the flat arrays grow, not the
+	// TreeNode tree.  A query expands only the pending nodes above its
+	// maxDepth, if it has one.  expand() builds the cells in a region ahead
+	// of time (the landing zone, say).
+	//
+	// Expanding changes no query's answer, so the const queries may do it:
+	// the arrays it grows, the build scratch it uses and the pointers the
+	// queries read are the mutable members below.
+	//
+	void expand(const Box & region);
+	void expand(const vector<int> & pending) const;
+	void expandNode(int node) const;
+	void markPending(const Box & rootCell);
+	int numPending() const;
+
+	MeshView view;			// the mesh the octree reads: "mesh", "packed" or the caller's arrays
+	ofMesh mesh;			// the octree's own copy, after create(ofMesh) or load(ofMesh)
+	vector<float> packed;	// x, y, z of each vertex, with bPackVertices
+	bool bPackVertices = false;
 	TreeNode root;
+	mutable vector<int> points;		// mesh point indices, permuted so nodes are contiguous runs
+	mutable vector<FlatNode> nodes;
+	mutable vector<ChildBounds> childBounds;	// one per interior node, see FlatNode::bounds
 	bool bUseFaces = false;
+	int maxLeafFaces = 8;				// face octree: split nodes with more faces than this
+	int maxLeafPoints = 1;				// point octree: split nodes with more points than this
+	float minCellSize = 0;				// don't split a node into children smaller than this
+	mutable vector<float> buildCoords[3];	// x, y, z of points[i] (vertex or face centroid), SoA, only during the build
+	mutable vector<float> scatterCoords[3];	// partitionPoints() scratch, only during the build; a node uses
+	mutable vector<int> scatterPoints;		// the run [begin, end) of these, so threads can share them
+	mutable vector<unsigned char> octants;
+	mutable int scratchBase = 0;			// the scratch covers points from here (expanding one lazy node)
+	mutable vector<float> faceData[9];		// face octree: v0, edge1, edge2 (x, y, z) of face points[i], SoA
+	bool bKeepInteriorPoints = true;	// false: only leaves keep a point run
+	bool bKeepTree = true;				// false: free the TreeNode tree once flattened
+	BuildMethod buildMethod = BuildTopDown;	// method used by create()
+	int levels = 0;						// numLevels of the last create()/load()
+	bool bLazy = false;					// create() builds prebuiltLevels levels, the rest on demand
+	int prebuiltLevels = 4;
+	shared_ptr<LazyNodes> lazy;			// pending cells and their lock, after a lazy create()
+
+	// the arrays the queries read: the vectors above after create(), or the
+	// mapped cache file after load().  Call bindArrays() after copying an
+	// Octree that was built rather than loaded.
+	//
+	mutable const FlatNode *nodeData = nullptr;
+	mutable int numNodes = 0;
+	mutable const ChildBounds *boundsData = nullptr;
+	mutable const int *pointData = nullptr;
+	mutable int numPointData = 0;		// entries of pointData, more than the mesh points after updates
+	mutable const float *faceCols[9] = {};
+	shared_ptr<MappedFile> cache;
+
+	// lookup tables built by prepareUpdates()
+	//
+	mutable bool bUpdatesReady = false;
+	vector<int> parents;				// face octree: parent of each node
+	vector<int> faceSlot;				// face octree: position of each face in points
+	vector<int> slotLeaf;				// face octree: leaf holding each position of points
+	vector<int> vertexFaceStart, vertexFaces;	// face octree: faces around each vertex
+	int deadNodes = 0, deadPoints = 0;	// slots the updates left unused, see compact()
 	ofColor colors[10] = { ofColor::white, ofColor::red, ofColor::orange, ofColor::yellow, ofColor::green,
 						   ofColor::blue, ofColor::indigo, ofColor::violet, ofColor::pink, ofColor::brown };
 
 	// debug;
 	//
 	int strayVerts= 0;
-	int numLeaf = 0;
+	mutable int numLeaf = 0;
+};
+
+//  Node of a CompactOctree: the box is not stored, it is decoded from the
+//  parent's QuantBounds on the way down.
+//
+class CompactNode {
+public:
+	int firstChild = -1;
+	int begin = 0, end = 0;	// run of CompactOctree::points in this node
+	int bounds = -1;		// interior node: its children's boxes in CompactOctree::bounds
+
+	bool isLeaf() const { return bounds < 0; }
+};
+
+//  Boxes of the children of an interior node, each side quantized to 8 bits
+//  within the node's own (decoded) box: 0 is its min and 255 its max.  Slot k
+//  is the node's k-th child.
+//
+class QuantBounds {
+public:
+	unsigned char lo[3][8];
+	unsigned char hi[3][8];
+	unsigned char numChildren;
+};
+
+//  Compact, read-only copy of a built Octree for keeping several large
+//  terrains in memory.  The node boxes are quantized (QuantBounds) and each
+//  leaf point is stored as three 16-bit offsets within its leaf's box, so a
+//  node takes 16 bytes plus 49 for an interior node's children instead of
+//  44 plus 192.  Boxes are rounded outward and the root is grown a little,
+//  so the decoded boxes always contain the real ones and no hit is lost: ray
+//  and box queries find at least what the Octree finds (a point octree's hit
+//  may be entered slightly earlier, intersectTop may be slightly higher), and
+//  withinRadius may also return points up to half a 16-bit step of their
+//  leaf box beyond r.  Triangles of a face octree stay full precision so
+//  triangle hits are exact.
+//
+class CompactOctree {
+public:
+	void create(const Octree & tree);
+	bool intersect(const Ray &, RayHit & hit, float tMin = 0, float tMax = FLT_MAX) const;
+	bool intersectAny(const Box &) const;
+	bool intersectTop(const Box &, float & topRtn) const;
+	int withinRadius(const ofVec3f & p, float r, vector<PointHit> & hits) const;
+	size_t memoryUsage() const;
+
+	Box rootBox;
+	bool bUseFaces = false;
+	vector<CompactNode> nodes;
+	vector<QuantBounds> bounds;
+	vector<int> points;						// mesh point (face) indices, as in Octree::points
+	vector<unsigned short> pointOffsets;	// point octree: x, y, z of points[i] in its leaf box
+	vector<float> faceData[9];				// face octree: as Octree::faceData
 };
\ No newline at end of file
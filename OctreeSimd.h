@@ -0,0 +1,388 @@
+//--------------------------------------------------------------
+//
+//  SIMD kernels used by the Octree queries and build.
+//
+//  OCTREE_SSE is defined when SSE2 is available (always on x64) and
+//  OCTREE_AVX when the compiler targets AVX (/arch:AVX2, -mavx2); every
+//  kernel has a plain scalar version with the same results otherwise.
+//
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCTREE_SSE 1
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__)
+#define OCTREE_AVX 1
+#include <immintrin.h>
+#endif
+
+// rayTriangles4:  Moller-Trumbore test of one ray against the four triangles
+//                 i..i+3 stored SoA in tri[0..8] (v0 x,y,z, edge1 x,y,z,
+//                 edge2 x,y,z).  Both sides of a triangle count as a hit.
+//                 Returns a 4-bit mask of the lanes hit inside (tmin, tmax)
+//                 and writes their distance and barycentrics to t, u, v.
+//
+inline int rayTriangles4(const float o[3], const float d[3], const float *const tri[9], int i,
+	float tmin, float tmax, float t[4], float u[4], float v[4])
+{
+#ifdef OCTREE_SSE
+	__m128 v0x = _mm_loadu_ps(tri[0] + i), v0y = _mm_loadu_ps(tri[1] + i), v0z = _mm_loadu_ps(tri[2] + i);
+	__m128 e1x = _mm_loadu_ps(tri[3] + i), e1y = _mm_loadu_ps(tri[4] + i), e1z = _mm_loadu_ps(tri[5] + i);
+	__m128 e2x = _mm_loadu_ps(tri[6] + i), e2y = _mm_loadu_ps(tri[7] + i), e2z = _mm_loadu_ps(tri[8] + i);
+	__m128 dx = _mm_set1_ps(d[0]), dy = _mm_set1_ps(d[1]), dz = _mm_set1_ps(d[2]);
+
+	// p = d x e2, det = e1 . p
+	__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	__m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+	__m128 ok = _mm_cmpgt_ps(absDet, _mm_set1_ps(1e-12f));
+	__m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+	// s = o - v0, u = (s . p) / det
+	__m128 sx = _mm_sub_ps(_mm_set1_ps(o[0]), v0x);
+	__m128 sy = _mm_sub_ps(_mm_set1_ps(o[1]), v0y);
+	__m128 sz = _mm_sub_ps(_mm_set1_ps(o[2]), v0z);
+	__m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv);
+
+	// q = s x e1, v = (d . q) / det, t = (e2 . q) / det
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+	__m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv);
+	__m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv);
+
+	__m128 zero = _mm_setzero_ps();
+	ok = _mm_and_ps(ok, _mm_cmpge_ps(uu, zero));
+	ok = _mm_and_ps(ok, _mm_cmpge_ps(vv, zero));
+	ok = _mm_and_ps(ok, _mm_cmple_ps(_mm_add_ps(uu, vv), _mm_set1_ps(1.0f)));
+	ok = _mm_and_ps(ok, _mm_cmpgt_ps(tt, _mm_set1_ps(tmin)));
+	ok = _mm_and_ps(ok, _mm_cmplt_ps(tt, _mm_set1_ps(tmax)));
+
+	_mm_storeu_ps(t, tt);
+	_mm_storeu_ps(u, uu);
+	_mm_storeu_ps(v, vv);
+	return _mm_movemask_ps(ok);
+#else
+	int mask = 0;
+	for (int k = 0; k < 4; k++) {
+		int j = i + k;
+		float e1[3] = { tri[3][j], tri[4][j], tri[5][j] };
+		float e2[3] = { tri[6][j], tri[7][j], tri[8][j] };
+		float p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+		float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+		if (det > -1e-12f && det < 1e-12f) continue;
+		float inv = 1.0f / det;
+		float s[3] = { o[0] - tri[0][j], o[1] - tri[1][j], o[2] - tri[2][j] };
+		u[k] = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+		float q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+		v[k] = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv;
+		t[k] = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv;
+		if (u[k] >= 0 && v[k] >= 0 && u[k] + v[k] <= 1 && t[k] > tmin && t[k] < tmax)
+			mask |= 1 << k;
+	}
+	return mask;
+#endif
+}
+
+// slabTest4:  slab test (Williams et al., as in Box::intersect) of the four
+//             rays i..i+3, given SoA as origins o[axis] and inverse
+//             directions inv[axis], against one box.  Ray k is limited to
+//             (tMin, tMax[i + k]).  Returns the mask of rays that hit and
+//             writes the distance at which each enters the box to tEnter.
+//
+inline int slabTest4(const float *const o[3], const float *const inv[3], int i,
+	const float bmin[3], const float bmax[3], float tMin, const float *tMax, float tEnter[4])
+{
+#ifdef OCTREE_SSE
+	__m128 lo = _mm_set1_ps(tMin);
+	__m128 hi = _mm_loadu_ps(tMax + i);
+	for (int a = 0; a < 3; a++) {
+		__m128 oa = _mm_loadu_ps(o[a] + i);
+		__m128 ia = _mm_loadu_ps(inv[a] + i);
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmin[a]), oa), ia);
+		__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmax[a]), oa), ia);
+		lo = _mm_max_ps(lo, _mm_min_ps(t1, t2));
+		hi = _mm_min_ps(hi, _mm_max_ps(t1, t2));
+	}
+	_mm_storeu_ps(tEnter, lo);
+	return _mm_movemask_ps(_mm_cmple_ps(lo, hi));
+#else
+	int mask = 0;
+	for (int k = 0; k < 4; k++) {
+		float lo = tMin, hi = tMax[i + k];
+		for (int a = 0; a < 3; a++) {
+			float t1 = (bmin[a] - o[a][i + k]) * inv[a][i + k];
+			float t2 = (bmax[a] - o[a][i + k]) * inv[a][i + k];
+			if (t1 > t2) { float tmp = t1; t1 = t2; t2 = tmp; }
+			if (t1 > lo) lo = t1;
+			if (t2 < hi) hi = t2;
+		}
+		tEnter[k] = lo;
+		if (lo <= hi) mask |= 1 << k;
+	}
+	return mask;
+#endif
+}
+
+// slabTest8:  Box::intersect (Williams et al.) of one ray against the eight
+//             boxes lo[axis][k], hi[axis][k] (SoA).  sign[] is the ray's
+//             Ray::sign, so the near and far planes are picked per axis for
+//             all eight boxes at once, exactly as the scalar test does.
+//             Returns the mask of boxes hit inside (t0, t1) and writes the
+//             distance at which the ray enters each to tEnter.
+//
+inline int slabTest8(const float o[3], const float inv[3], const int sign[3],
+	const float lo[3][8], const float hi[3][8], float t0, float t1, float tEnter[8])
+{
+#if defined(OCTREE_AVX)
+	__m256 tmin, tmax, miss = _mm256_setzero_ps();
+	for (int a = 0; a < 3; a++) {
+		__m256 oa = _mm256_set1_ps(o[a]), ia = _mm256_set1_ps(inv[a]);
+		__m256 n = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(sign[a] ? hi[a] : lo[a]), oa), ia);
+		__m256 f = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(sign[a] ? lo[a] : hi[a]), oa), ia);
+		if (a == 0) {
+			tmin = n;
+			tmax = f;
+			continue;
+		}
+		miss = _mm256_or_ps(miss, _mm256_or_ps(_mm256_cmp_ps(tmin, f, _CMP_GT_OQ), _mm256_cmp_ps(n, tmax, _CMP_GT_OQ)));
+		tmin = _mm256_max_ps(n, tmin);
+		tmax = _mm256_min_ps(f, tmax);
+	}
+	__m256 hit = _mm256_and_ps(_mm256_cmp_ps(tmin, _mm256_set1_ps(t1), _CMP_LT_OQ),
+		_mm256_cmp_ps(tmax, _mm256_set1_ps(t0), _CMP_GT_OQ));
+	_mm256_storeu_ps(tEnter, _mm256_max_ps(tmin, _mm256_set1_ps(t0)));
+	return _mm256_movemask_ps(_mm256_andnot_ps(miss, hit));
+#elif defined(OCTREE_SSE)
+	int mask = 0;
+	for (int h = 0; h < 8; h += 4) {
+		__m128 tmin, tmax, miss = _mm_setzero_ps();
+		for (int a = 0; a < 3; a++) {
+			__m128 oa = _mm_set1_ps(o[a]), ia = _mm_set1_ps(inv[a]);
+			__m128 n = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps((sign[a] ? hi[a] : lo[a]) + h), oa), ia);
+			__m128 f = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps((sign[a] ? lo[a] : hi[a]) + h), oa), ia);
+			if (a == 0) {
+				tmin = n;
+				tmax = f;
+				continue;
+			}
+			miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmpgt_ps(tmin, f), _mm_cmpgt_ps(n, tmax)));
+			tmin = _mm_max_ps(n, tmin);
+			tmax = _mm_min_ps(f, tmax);
+		}
+		__m128 hit = _mm_and_ps(_mm_cmplt_ps(tmin, _mm_set1_ps(t1)), _mm_cmpgt_ps(tmax, _mm_set1_ps(t0)));
+		_mm_storeu_ps(tEnter + h, _mm_max_ps(tmin, _mm_set1_ps(t0)));
+		mask |= _mm_movemask_ps(_mm_andnot_ps(miss, hit)) << h;
+	}
+	return mask;
+#else
+	int mask = 0;
+	for (int k = 0; k < 8; k++) {
+		bool miss = false;
+		float tmin = 0, tmax = 0;
+		for (int a = 0; a < 3; a++) {
+			float n = ((sign[a] ? hi[a][k] : lo[a][k]) - o[a]) * inv[a];
+			float f = ((sign[a] ? lo[a][k] : hi[a][k]) - o[a]) * inv[a];
+			if (a == 0) {
+				tmin = n;
+				tmax = f;
+				continue;
+			}
+			if (tmin > f || n > tmax) miss = true;
+			if (n > tmin) tmin = n;
+			if (f < tmax) tmax = f;
+		}
+		tEnter[k] = tmin > t0 ? tmin : t0;
+		if (!miss && tmin < t1 && tmax > t0) mask |= 1 << k;
+	}
+	return mask;
+#endif
+}
+
+// overlap8:  Box::overlap of the box (bmin, bmax) against the eight boxes
+//            lo[axis][k], hi[axis][k].  Returns the mask of boxes overlapped.
+//
+inline int overlap8(const float lo[3][8], const float hi[3][8], const float bmin[3], const float bmax[3])
+{
+#if defined(OCTREE_AVX)
+	__m256 ok = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+	for (int a = 0; a < 3; a++) {
+		ok = _mm256_and_ps(ok, _mm256_cmp_ps(_mm256_loadu_ps(lo[a]), _mm256_set1_ps(bmax[a]), _CMP_LE_OQ));
+		ok = _mm256_and_ps(ok, _mm256_cmp_ps(_mm256_loadu_ps(hi[a]), _mm256_set1_ps(bmin[a]), _CMP_GE_OQ));
+	}
+	return _mm256_movemask_ps(ok);
+#elif defined(OCTREE_SSE)
+	int mask = 0;
+	for (int h = 0; h < 8; h += 4) {
+		__m128 ok = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int a = 0; a < 3; a++) {
+			ok = _mm_and_ps(ok, _mm_cmple_ps(_mm_loadu_ps(lo[a] + h), _mm_set1_ps(bmax[a])));
+			ok = _mm_and_ps(ok, _mm_cmpge_ps(_mm_loadu_ps(hi[a] + h), _mm_set1_ps(bmin[a])));
+		}
+		mask |= _mm_movemask_ps(ok) << h;
+	}
+	return mask;
+#else
+	int mask = 0;
+	for (int k = 0; k < 8; k++) {
+		if (lo[0][k] <= bmax[0] && hi[0][k] >= bmin[0] &&
+			lo[1][k] <= bmax[1] && hi[1][k] >= bmin[1] &&
+			lo[2][k] <= bmax[2] && hi[2][k] >= bmin[2])
+			mask |= 1 << k;
+	}
+	return mask;
+#endif
+}
+
+// boxDist8:  squared distance from point p to each of the eight boxes
+//            lo[axis][k], hi[axis][k] (0 for a box that contains p)
+//
+inline void boxDist8(const float lo[3][8], const float hi[3][8], const float p[3], float d2[8])
+{
+#if defined(OCTREE_AVX)
+	__m256 sum = _mm256_setzero_ps();
+	for (int a = 0; a < 3; a++) {
+		__m256 pa = _mm256_set1_ps(p[a]);
+		__m256 d = _mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(lo[a]), pa), _mm256_sub_ps(pa, _mm256_loadu_ps(hi[a])));
+		d = _mm256_max_ps(d, _mm256_setzero_ps());
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(d, d));
+	}
+	_mm256_storeu_ps(d2, sum);
+#elif defined(OCTREE_SSE)
+	for (int h = 0; h < 8; h += 4) {
+		__m128 sum = _mm_setzero_ps();
+		for (int a = 0; a < 3; a++) {
+			__m128 pa = _mm_set1_ps(p[a]);
+			__m128 d = _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(lo[a] + h), pa), _mm_sub_ps(pa, _mm_loadu_ps(hi[a] + h)));
+			d = _mm_max_ps(d, _mm_setzero_ps());
+			sum = _mm_add_ps(sum, _mm_mul_ps(d, d));
+		}
+		_mm_storeu_ps(d2 + h, sum);
+	}
+#else
+	for (int k = 0; k < 8; k++) {
+		d2[k] = 0;
+		for (int a = 0; a < 3; a++) {
+			float d = lo[a][k] - p[a];
+			if (p[a] - hi[a][k] > d) d = p[a] - hi[a][k];
+			if (d > 0) d2[k] += d * d;
+		}
+	}
+#endif
+}
+
+// pointDist8:  squared distance from p to each of the eight points x, y, z
+//              (SoA), for scanning the points of a leaf
+//
+inline void pointDist8(const float x[8], const float y[8], const float z[8], const float p[3], float d2[8])
+{
+#if defined(OCTREE_AVX)
+	__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x), _mm256_set1_ps(p[0]));
+	__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y), _mm256_set1_ps(p[1]));
+	__m256 dz = _mm256_sub_ps(_mm256_loadu_ps(z), _mm256_set1_ps(p[2]));
+	_mm256_storeu_ps(d2, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz)));
+#elif defined(OCTREE_SSE)
+	for (int h = 0; h < 8; h += 4) {
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(x + h), _mm_set1_ps(p[0]));
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(y + h), _mm_set1_ps(p[1]));
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(z + h), _mm_set1_ps(p[2]));
+		_mm_storeu_ps(d2 + h, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+	}
+#else
+	for (int k = 0; k < 8; k++) {
+		float dx = x[k] - p[0], dy = y[k] - p[1], dz = z[k] - p[2];
+		d2[k] = dx * dx + dy * dy + dz * dz;
+	}
+#endif
+}
+
+// rayPointDist8:  squared distance from each of the eight points x, y, z
+//                 (SoA) to the ray from o along d, measured to the nearest
+//                 point of the ray at or ahead of o.  invLen2 is 1 / |d|^2.
+//
+inline void rayPointDist8(const float x[8], const float y[8], const float z[8], const float o[3],
+	const float d[3], float invLen2, float d2[8])
+{
+#if defined(OCTREE_AVX)
+	__m256 vx = _mm256_sub_ps(_mm256_loadu_ps(x), _mm256_set1_ps(o[0]));
+	__m256 vy = _mm256_sub_ps(_mm256_loadu_ps(y), _mm256_set1_ps(o[1]));
+	__m256 vz = _mm256_sub_ps(_mm256_loadu_ps(z), _mm256_set1_ps(o[2]));
+	__m256 dx = _mm256_set1_ps(d[0]), dy = _mm256_set1_ps(d[1]), dz = _mm256_set1_ps(d[2]);
+	__m256 t = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, dx), _mm256_mul_ps(vy, dy)), _mm256_mul_ps(vz, dz));
+	t = _mm256_max_ps(_mm256_mul_ps(t, _mm256_set1_ps(invLen2)), _mm256_setzero_ps());
+	vx = _mm256_sub_ps(vx, _mm256_mul_ps(t, dx));
+	vy = _mm256_sub_ps(vy, _mm256_mul_ps(t, dy));
+	vz = _mm256_sub_ps(vz, _mm256_mul_ps(t, dz));
+	_mm256_storeu_ps(d2, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz)));
+#elif defined(OCTREE_SSE)
+	__m128 dx = _mm_set1_ps(d[0]), dy = _mm_set1_ps(d[1]), dz = _mm_set1_ps(d[2]);
+	for (int h = 0; h < 8; h += 4) {
+		__m128 vx = _mm_sub_ps(_mm_loadu_ps(x + h), _mm_set1_ps(o[0]));
+		__m128 vy = _mm_sub_ps(_mm_loadu_ps(y + h), _mm_set1_ps(o[1]));
+		__m128 vz = _mm_sub_ps(_mm_loadu_ps(z + h), _mm_set1_ps(o[2]));
+		__m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, dx), _mm_mul_ps(vy, dy)), _mm_mul_ps(vz, dz));
+		t = _mm_max_ps(_mm_mul_ps(t, _mm_set1_ps(invLen2)), _mm_setzero_ps());
+		vx = _mm_sub_ps(vx, _mm_mul_ps(t, dx));
+		vy = _mm_sub_ps(vy, _mm_mul_ps(t, dy));
+		vz = _mm_sub_ps(vz, _mm_mul_ps(t, dz));
+		_mm_storeu_ps(d2 + h, _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz)));
+	}
+#else
+	for (int k = 0; k < 8; k++) {
+		float vx = x[k] - o[0], vy = y[k] - o[1], vz = z[k] - o[2];
+		float t = (vx * d[0] + vy * d[1] + vz * d[2]) * invLen2;
+		if (t < 0) t = 0;
+		vx -= t * d[0];
+		vy -= t * d[1];
+		vz -= t * d[2];
+		d2[k] = vx * vx + vy * vy + vz * vz;
+	}
+#endif
+}
+
+// classifyOctants:  octant of each of the n points (x[i], y[i], z[i]) about
+//                   the centre c, written to octantRtn; bit 0/1/2 is set when
+//                   the point is at or above c in x/y/z, so a point on a
+//                   split plane goes to the upper side and a NaN, which
+//                   compares false, to the lower side in every path.
+//                   count[o] is incremented for each point in octant o.
+//
+inline void classifyOctants(const float *x, const float *y, const float *z, int n, const float c[3],
+	unsigned char *octantRtn, int count[8])
+{
+	int i = 0;
+	int o[8];
+#if defined(OCTREE_AVX)
+	__m256 cx = _mm256_set1_ps(c[0]), cy = _mm256_set1_ps(c[1]), cz = _mm256_set1_ps(c[2]);
+	for (; i + 8 <= n; i += 8) {
+		__m256 bits = _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(x + i), cx, _CMP_GE_OQ), _mm256_set1_ps(1.0f));
+		bits = _mm256_add_ps(bits, _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(y + i), cy, _CMP_GE_OQ), _mm256_set1_ps(2.0f)));
+		bits = _mm256_add_ps(bits, _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(z + i), cz, _CMP_GE_OQ), _mm256_set1_ps(4.0f)));
+		_mm256_storeu_si256((__m256i *)o, _mm256_cvttps_epi32(bits));
+		for (int k = 0; k < 8; k++) {
+			octantRtn[i + k] = o[k];
+			count[o[k]]++;
+		}
+	}
+#elif defined(OCTREE_SSE)
+	__m128 cx = _mm_set1_ps(c[0]), cy = _mm_set1_ps(c[1]), cz = _mm_set1_ps(c[2]);
+	for (; i + 4 <= n; i += 4) {
+		__m128 bits = _mm_and_ps(_mm_cmpge_ps(_mm_loadu_ps(x + i), cx), _mm_set1_ps(1.0f));
+		bits = _mm_add_ps(bits, _mm_and_ps(_mm_cmpge_ps(_mm_loadu_ps(y + i), cy), _mm_set1_ps(2.0f)));
+		bits = _mm_add_ps(bits, _mm_and_ps(_mm_cmpge_ps(_mm_loadu_ps(z + i), cz), _mm_set1_ps(4.0f)));
+		_mm_storeu_si128((__m128i *)o, _mm_cvttps_epi32(bits));
+		for (int k = 0; k < 4; k++) {
+			octantRtn[i + k] = o[k];
+			count[o[k]]++;
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		o[0] = int(x[i] >= c[0]) | (int(y[i] >= c[1]) << 1) | (int(z[i] >= c[2]) << 2);
+		octantRtn[i] = o[0];
+		count[o[0]]++;
+	}
+}
@@ -70,9 +70,17 @@ void ParticleSystem::update() {
 
 }
 
-// remove all particlies within "dist" of point (not implemented as yet)
+// remove all particles within "dist" of point, keeping the others in order.
+// Returns the number removed.
 //
-int ParticleSystem::removeNear(const ofVec3f & point, float dist) { return 0; }
+int ParticleSystem::removeNear(const ofVec3f & point, float dist) {
+	float dist2 = dist * dist;
+	int n = particles.size();
+	particles.erase(std::remove_if(particles.begin(), particles.end(), [&](const Particle & p) {
+		return (p.position - point).lengthSquared() <= dist2;
+	}), particles.end());
+	return n - particles.size();
+}
 
 //  draw the particle cloud
 //
@@ -0,0 +1,147 @@
+
+#include "SpatialIndex.h"
+
+QueryContext & QueryContext::local() {
+	static thread_local QueryContext context;
+	return context;
+}
+
+void BenchmarkQueries::make(const MeshView & mesh, int n) {
+	ofVec3f lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int i = 0; i < mesh.numVertices; i++) {
+		ofVec3f v = mesh.vertex(i);
+		lo.x = std::min(lo.x, v.x); lo.y = std::min(lo.y, v.y); lo.z = std::min(lo.z, v.z);
+		hi.x = std::max(hi.x, v.x); hi.y = std::max(hi.y, v.y); hi.z = std::max(hi.z, v.z);
+	}
+	bounds = Box(Vector3(lo.x, lo.y, lo.z), Vector3(hi.x, hi.y, hi.z));
+	ofVec3f size = hi - lo;
+	Vector3 half(size.x * 0.005f, size.y * 0.005f, size.z * 0.005f);
+
+	rays.clear();
+	boxes.clear();
+	points.clear();
+	for (int i = 0; i < n; i++) {
+		Vector3 from(ofRandom(lo.x, hi.x), hi.y + size.y, ofRandom(lo.z, hi.z));
+		Vector3 to(ofRandom(lo.x, hi.x), lo.y, ofRandom(lo.z, hi.z));
+		rays.push_back(Ray(from, to - from));
+		ofVec3f v = mesh.vertex((int)ofRandom(mesh.numVertices - 1));
+		boxes.push_back(Box(Vector3(v.x, v.y, v.z) - half, Vector3(v.x, v.y, v.z) + half));
+		points.push_back(v + ofVec3f(0, size.y * 0.01f, 0));
+	}
+}
+
+// sweepTriangle:  time of impact of "box" moving by "move" with triangle
+//                 "tri" (three equal corners make a point), by the separating
+//                 axis test carried over the move: the box axes, the
+//                 triangle's normal and the nine edge cross products.  tRtn
+//                 is the fraction of the move at first contact and normalRtn
+//                 the last axis to stop separating them, facing the box.  A
+//                 box that already overlaps the triangle hits it at 0 if it
+//                 moves further in along the shortest way out of it, and not
+//                 at all if it moves away, so a box resting on the terrain
+//                 can lift off or slide but not sink.
+//
+bool SpatialIndex::sweepTriangle(const Box & box, const Vector3 & move, const Vector3 tri[3], float & tRtn, Vector3 & normalRtn) {
+	Vector3 c = box.center();
+	Vector3 half = (box.max() - box.min()) / 2;
+	Vector3 p[3] = { tri[0] - c, tri[1] - c, tri[2] - c };
+	Vector3 e[3] = { p[1] - p[0], p[2] - p[1], p[0] - p[2] };
+	Vector3 n = e[0] ^ e[2];
+	float size = e[0].length() + e[1].length() + e[2].length();
+
+	float tEnter = -FLT_MAX, tExit = FLT_MAX;
+	Vector3 enterAxis(0, 0, 0);
+	float depth = FLT_MAX;					// shortest way out at the start
+	Vector3 outAxis(0, 0, 0);
+	auto separates = [&](Vector3 axis, float minLength) {
+		float len = axis.length();
+		if (len <= minLength) return false;		// (nearly) parallel edges: no axis
+		axis = axis / len;
+		float r = half.x() * fabsf(axis.x()) + half.y() * fabsf(axis.y()) + half.z() * fabsf(axis.z());
+		float d0 = p[0] * axis, d1 = p[1] * axis, d2 = p[2] * axis;
+		float lo = std::min(d0, std::min(d1, d2)) - r;
+		float hi = std::max(d0, std::max(d1, d2)) + r;
+		if (std::min(hi, -lo) < depth) {
+			depth = std::min(hi, -lo);
+			outAxis = hi < -lo ? axis : -axis;
+		}
+		float s = move * axis;
+		if (s == 0) return lo > 0 || hi < 0;
+		float t0 = lo / s, t1 = hi / s;
+		if (t0 > t1) std::swap(t0, t1);
+		if (t0 > tEnter) {
+			tEnter = t0;
+			enterAxis = s > 0 ? -axis : axis;
+		}
+		tExit = std::min(tExit, t1);
+		return tEnter > tExit;
+	};
+	Vector3 unit[3] = { Vector3(1, 0, 0), Vector3(0, 1, 0), Vector3(0, 0, 1) };
+	for (int a = 0; a < 3; a++) {
+		if (separates(unit[a], 0)) return false;
+	}
+	if (separates(n, 1e-6f * size * size)) return false;
+	for (int a = 0; a < 3; a++) {
+		for (int k = 0; k < 3; k++) {
+			if (separates(unit[a] ^ e[k], 1e-6f * size)) return false;
+		}
+	}
+	if (tExit < 0 || tEnter > 1) return false;
+	if (tEnter >= 0) {
+		tRtn = tEnter;
+		normalRtn = enterAxis;
+		return true;
+	}
+
+	// overlapping at the start: a point has no way out
+	//
+	if (size == 0 || move * outAxis >= 0) return false;
+	tRtn = 0;
+	normalRtn = outAxis;
+	return true;
+}
+
+// benchmark:  build "index" for "mesh", then print the build time, memory
+//             and the throughput of random ray, box (intersectTop) and
+//             nearest-vertex queries over the terrain, the numbers for
+//             choosing an index type per asset
+//
+void SpatialIndex::benchmark(SpatialIndex & index, const ofMesh & mesh, int numThreads) {
+	uint64_t start = ofGetElapsedTimeMicros();
+	index.build(mesh, numThreads);
+	float buildMs = (ofGetElapsedTimeMicros() - start) / 1000.0;
+
+	// the same queries for every index
+	//
+	ofSeedRandom(1);
+	BenchmarkQueries queries;
+	queries.make(MeshView(mesh));
+	int numQueries = queries.rays.size();
+
+	int hits = 0;
+	RayHit hit;
+	start = ofGetElapsedTimeMicros();
+	for (int i = 0; i < numQueries; i++) hits += index.intersect(queries.rays[i], hit);
+	float rayUs = (ofGetElapsedTimeMicros() - start) / (float)numQueries;
+
+	float top;
+	start = ofGetElapsedTimeMicros();
+	for (int i = 0; i < numQueries; i++) hits += index.intersectTop(queries.boxes[i], top);
+	float boxUs = (ofGetElapsedTimeMicros() - start) / (float)numQueries;
+
+	// an index that holds no points (a face octree) answers no knn
+	// queries, so there is no rate to report for it
+	//
+	int found = 0;
+	vector<PointHit> nearest;
+	start = ofGetElapsedTimeMicros();
+	for (int i = 0; i < numQueries; i++) found += index.knn(queries.points[i], 1, nearest);
+	float knnUs = (ofGetElapsedTimeMicros() - start) / (float)numQueries;
+	hits += found;
+
+	cout << index.name() << ": build " << buildMs << "ms, " << index.memoryUsage() / 1024 << "KB, " <<
+		"queries/s: ray " << (int)(1e6 / rayUs) << " box " << (int)(1e6 / boxUs) << " knn ";
+	if (found > 0) cout << (int)(1e6 / knnUs);
+	else cout << "n/a";
+	cout << " (" << hits << " hits)" << endl;
+}
@@ -0,0 +1,159 @@
+//--------------------------------------------------------------
+//
+//  SpatialIndex:  the terrain queries the app runs for picking and
+//  collision, so that the index type can be picked per asset.  Octree and
+//  Bvh implement it; SpatialIndex::benchmark() measures one on a mesh.
+//
+#pragma once
+#include "ofMain.h"
+#include "box.h"
+#include "ray.h"
+#include <float.h>
+#include <limits.h>
+
+//  A read-only view of a mesh: vertex i at vertices + i * stride (x, y, z
+//  first) and the triangles' vertex indices, or consecutive vertices when
+//  there are none.  Nothing is copied: the arrays belong to the caller (an
+//  ofMesh, a mapped file, a CPU mirror of a vertex buffer) and must stay in
+//  place as long as an index built on the view is used.
+//
+class MeshView {
+public:
+	MeshView() {}
+	MeshView(const ofMesh & mesh) :
+		vertices((const float *)mesh.getVerticesPointer()), numVertices(mesh.getNumVertices()),
+		stride(sizeof(ofDefaultVertexType) / sizeof(float)),
+		indices(mesh.getIndexPointer()), numIndices(mesh.getNumIndices()) {}
+	MeshView(const float *vertices, int numVertices, int stride = 3, const ofIndexType *indices = nullptr, int numIndices = 0) :
+		vertices(vertices), numVertices(numVertices), stride(stride), indices(indices), numIndices(numIndices) {}
+
+	ofVec3f vertex(int i) const {
+		const float *v = vertices + (size_t)i * stride;
+		return ofVec3f(v[0], v[1], v[2]);
+	}
+	int numFaces() const { return numIndices > 0 ? numIndices / 3 : numVertices / 3; }
+	int faceVertex(int face, int k) const { return numIndices > 0 ? indices[3 * face + k] : 3 * face + k; }
+
+	const float *vertices = nullptr;
+	int numVertices = 0;
+	int stride = 3;					// floats from one vertex to the next
+	const ofIndexType *indices = nullptr;
+	int numIndices = 0;
+};
+
+//  Result of a ray query.  In a triangle index (face octree, Bvh) "index" is
+//  the triangle that was hit and (u, v) its barycentrics; in a point octree
+//  "index" is the mesh vertex of the leaf that was hit.  A swept box query
+//  also returns the contact normal.
+//
+class RayHit {
+public:
+	float t = 0;			// distance along the ray
+	int node = -1;			// node index of the leaf
+	int index = -1;
+	float u = 0, v = 0;
+	Vector3 point;
+	Vector3 normal = Vector3(0, 0, 0);	// swept query: facing the box
+};
+
+//  Result of a point query (knn, withinRadius): a mesh vertex and its distance.
+//
+class PointHit {
+public:
+	int index = -1;
+	float dist = 0;
+};
+
+//  Points of one leaf found by a box query: the run [begin, end) of mesh
+//  point indices (face indices in a face octree), pointing into the index.
+//
+class PointSpan {
+public:
+	const int *begin = nullptr;
+	const int *end = nullptr;
+	int node = -1;
+
+	int size() const { return end - begin; }
+};
+
+class TerrainTile;
+
+//  Scratch space of the queries that need more than a fixed stack: the
+//  priority queues of knn, the leaf spans of getPointsInBox and the tile
+//  orders and per-tile hits of the TerrainTiles queries.  The buffers
+//  keep their capacity between queries, so once a context has grown to the
+//  largest query the query path does not allocate.  An index is only read
+//  by its const queries; each thread querying it brings its own context.
+//  The overloads without a context use QueryContext::local(), one per
+//  thread.
+//
+class QueryContext {
+public:
+	vector<std::pair<float, int>> open;		// knn: nodes by box distance
+	vector<std::pair<float, int>> best;		// knn: the k best so far
+	vector<PointSpan> spans;
+	vector<std::pair<float, const TerrainTile *>> tiles;	// tiles: by entry or box distance
+	vector<PointHit> tileHits;		// tiles knn: the hits in one tile
+	vector<ofVec3f> positions;		// tiles knn: where the k best are
+
+	static QueryContext & local();
+};
+
+//  The queries the benchmarks time on a terrain: rays from above its bounds
+//  to random points on its floor, boxes 0.5% of the bounds across around
+//  random mesh vertices, and nearest-vertex points a little above those
+//  vertices.  make() draws from ofRandom(); seed it first for the same
+//  queries in every run.
+//
+class BenchmarkQueries {
+public:
+	void make(const MeshView & mesh, int n = 20000);
+
+	Box bounds;
+	vector<Ray> rays;
+	vector<Box> boxes;
+	vector<ofVec3f> points;
+};
+
+class SpatialIndex {
+public:
+	virtual ~SpatialIndex() {}
+
+	// build the index for "mesh" (the index keeps its own copy of it, see
+	// Octree::create(MeshView) for one that doesn't)
+	//
+	virtual void build(const ofMesh & mesh, int numThreads = 1) = 0;
+
+	// closest hit inside (tMin, tMax)
+	//
+	virtual bool intersect(const Ray &, RayHit & hit, float tMin = 0, float tMax = FLT_MAX) const = 0;
+
+	// boxes of all leaves overlapping "box"
+	//
+	virtual bool intersect(const Box &, vector<Box> & boxListRtn) const = 0;
+
+	// any-hit test returning the highest top (max y) of the leaves
+	// overlapping "box"; a node at maxDepth (the root is 0) counts as a leaf
+	//
+	virtual bool intersectTop(const Box &, float & topRtn, int maxDepth = INT_MAX) const = 0;
+
+	// the k mesh vertices nearest to p, closest first
+	//
+	virtual int knn(const ofVec3f & p, int k, vector<PointHit> & hits) const = 0;
+
+	// earliest time of impact of "box" moving by "move" with the terrain's
+	// triangles (a point octree's vertices): hit.t is the fraction of the
+	// move, hit.point the box's center then (see sweepTriangle())
+	//
+	virtual bool intersectSwept(const Box &, const Vector3 & move, RayHit & hit) const = 0;
+
+	// move the mesh vertices verts[i] to pos[i] and update the index
+	//
+	virtual bool moveVertices(const vector<int> & verts, const vector<ofVec3f> & pos) = 0;
+
+	virtual size_t memoryUsage() const = 0;
+	virtual const char *name() const = 0;
+
+	static void benchmark(SpatialIndex & index, const ofMesh & mesh, int numThreads = 1);
+	static bool sweepTriangle(const Box & box, const Vector3 & move, const Vector3 tri[3], float & tRtn, Vector3 & normalRtn);
+};
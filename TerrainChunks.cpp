@@ -0,0 +1,103 @@
+#include "TerrainChunks.h"
+
+// build:  make a chunk of every node of "faceTree" at depth "level" (the root
+//         is 0), and of every leaf above it, and load their triangles into
+//         the index buffer.  Faces stay in the chunk they were built in when
+//         the tree's faces move later.
+//
+void TerrainChunks::build(const Octree & faceTree, int level, ofVbo & terrainVbo) {
+	tree = &faceTree;
+	this->level = level;
+	chunks.clear();
+	indices.clear();
+	nodeChunk.assign(faceTree.numNodes, -1);
+
+	// depth-first, children in order: the order of Octree::intersect(Frustum)
+	//
+	vector<int> stack(1, 0), depths(1, 0), faces;
+	while (!stack.empty() && faceTree.numNodes > 0) {
+		int i = stack.back(), depth = depths.back();
+		stack.pop_back();
+		depths.pop_back();
+		const FlatNode & node = faceTree.nodeData[i];
+		if (node.isLeaf() || depth >= level) {
+			TerrainChunk chunk;
+			chunk.node = i;
+			chunk.offset = indices.size();
+			faces.clear();
+			gather(i, faces);
+			for (int f = 0; f < faces.size(); f++) {
+				for (int k = 0; k < 3; k++) indices.push_back(faceTree.view.faceVertex(faces[f], k));
+			}
+			chunk.count = indices.size() - chunk.offset;
+			nodeChunk[i] = chunks.size();
+			chunks.push_back(chunk);
+			continue;
+		}
+		for (int k = node.numChildren() - 1; k >= 0; k--) {
+			stack.push_back(node.firstChild + k);
+			depths.push_back(depth + 1);
+		}
+	}
+
+	vbo.clear();
+	vbo.setVertexBuffer(terrainVbo.getVertexBuffer(), 3, sizeof(glm::vec3));
+	if (terrainVbo.getUsingNormals()) vbo.setNormalBuffer(terrainVbo.getNormalBuffer(), sizeof(glm::vec3));
+	if (terrainVbo.getUsingTexCoords()) vbo.setTexCoordBuffer(terrainVbo.getTexCoordBuffer(), sizeof(glm::vec2));
+	vbo.setIndexData(indices.data(), indices.size(), GL_STATIC_DRAW);
+
+	cout << "Terrain chunks: " << chunks.size() << " at level " << level << ", " << indices.size() / 3 << " triangles" << endl;
+}
+
+// gather:  the faces in the leaves below "node"
+//
+void TerrainChunks::gather(int node, vector<int> & facesRtn) const {
+	const FlatNode & n = tree->nodeData[node];
+	if (n.isLeaf()) {
+		for (int p = n.begin; p < n.end; p++) facesRtn.push_back(tree->pointData[p]);
+		return;
+	}
+	for (int k = 0; k < n.numChildren(); k++) gather(n.firstChild + k, facesRtn);
+}
+
+// draw:  draw the chunks whose nodes are in or cross "frustum" (in the
+//        terrain mesh's space), one call per run of consecutive chunks
+//
+void TerrainChunks::draw(const Frustum & frustum) {
+	drawCalls = chunksDrawn = trianglesDrawn = 0;
+	if (tree == nullptr) return;
+	visible.clear();
+	tree->intersect(frustum, level, visible);
+
+	int offset = 0, count = 0;
+	for (int i = 0; i < visible.size(); i++) {
+		int c = visible[i] < nodeChunk.size() ? nodeChunk[visible[i]] : -1;
+		if (c < 0 || chunks[c].count == 0) continue;
+		chunksDrawn++;
+		if (count > 0 && chunks[c].offset == offset + count) {
+			count += chunks[c].count;
+			continue;
+		}
+		if (count > 0) {
+			vbo.drawElements(GL_TRIANGLES, count, offset);
+			drawCalls++;
+			trianglesDrawn += count / 3;
+		}
+		offset = chunks[c].offset;
+		count = chunks[c].count;
+	}
+	if (count > 0) {
+		vbo.drawElements(GL_TRIANGLES, count, offset);
+		drawCalls++;
+		trianglesDrawn += count / 3;
+	}
+}
+
+// drawAll:  the whole terrain in one call
+//
+void TerrainChunks::drawAll() {
+	vbo.drawElements(GL_TRIANGLES, indices.size());
+	drawCalls = 1;
+	chunksDrawn = chunks.size();
+	trianglesDrawn = indices.size() / 3;
+}
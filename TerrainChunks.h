@@ -0,0 +1,40 @@
+//--------------------------------------------------------------
+//
+//  TerrainChunks:  the terrain's triangles grouped by the nodes of a face
+//  Octree at one level, so that only the chunks in the camera's frustum
+//  are drawn.  Each chunk is a run of one static index buffer, in the
+//  octree's depth-first order, so visible neighbours are drawn with a
+//  single call.  The vertex buffers are shared with the terrain's own VBO:
+//  vertices updated there (carveCrater) need no rebuild here.
+//
+#pragma once
+#include "Octree.h"
+
+class TerrainChunk {
+public:
+	int node = -1;			// face octree node
+	int offset = 0;			// run of TerrainChunks::indices
+	int count = 0;
+};
+
+class TerrainChunks {
+public:
+	void build(const Octree & faceTree, int level, ofVbo & terrainVbo);
+	void draw(const Frustum & frustum);
+	void drawAll();
+	void gather(int node, vector<int> & facesRtn) const;
+
+	const Octree *tree = nullptr;
+	int level = 0;
+	vector<TerrainChunk> chunks;
+	vector<int> nodeChunk;			// chunk of each octree node, -1 if none
+	vector<ofIndexType> indices;
+	ofVbo vbo;
+
+	// what the last draw submitted
+	//
+	int drawCalls = 0;
+	int chunksDrawn = 0;
+	int trianglesDrawn = 0;
+	vector<int> visible;
+};
@@ -0,0 +1,467 @@
+#include "TerrainTiles.h"
+
+static const int MaxTileLevels = 20;
+
+size_t TerrainTile::memoryUsage() const {
+	return faceTree.memoryUsage() + pointTree.memoryUsage();
+}
+
+TerrainTiles::~TerrainTiles() {
+	close();
+}
+
+// split:  cut "mesh" into a grid of tileSize x tileSize (in x and z) tiles,
+//         each triangle going to the tile holding its centroid, and write
+//         them to "dir" as tile_<i>_<j>.ply with a tiles.txt describing the
+//         grid.  A tile's bounds can reach past its grid cell by the
+//         triangles on its border.
+//
+bool TerrainTiles::split(const ofMesh & mesh, const string & dir, float tileSize) {
+	int numVerts = mesh.getNumVertices();
+	int numFaces = mesh.getNumIndices() > 0 ? mesh.getNumIndices() / 3 : numVerts / 3;
+	if (numFaces == 0 || tileSize <= 0) return false;
+	auto vertex = [&](int face, int k) {
+		return mesh.getNumIndices() > 0 ? (int)mesh.getIndex(3 * face + k) : 3 * face + k;
+	};
+
+	float minX = FLT_MAX, minZ = FLT_MAX, maxX = -FLT_MAX, maxZ = -FLT_MAX;
+	for (int i = 0; i < numVerts; i++) {
+		ofVec3f v = mesh.getVertex(i);
+		minX = std::min(minX, v.x); maxX = std::max(maxX, v.x);
+		minZ = std::min(minZ, v.z); maxZ = std::max(maxZ, v.z);
+	}
+	int gx = std::max(1, (int)ceilf((maxX - minX) / tileSize));
+	int gz = std::max(1, (int)ceilf((maxZ - minZ) / tileSize));
+
+	vector<vector<int>> cellFaces(gx * gz);
+	for (int f = 0; f < numFaces; f++) {
+		ofVec3f c = (mesh.getVertex(vertex(f, 0)) + mesh.getVertex(vertex(f, 1)) + mesh.getVertex(vertex(f, 2))) / 3;
+		int i = std::min(gx - 1, std::max(0, (int)((c.x - minX) / tileSize)));
+		int j = std::min(gz - 1, std::max(0, (int)((c.z - minZ) / tileSize)));
+		cellFaces[j * gx + i].push_back(f);
+	}
+
+	ofDirectory::createDirectory(dir, false, true);
+	FILE *fp = fopen((dir + "/tiles.txt").c_str(), "w");
+	if (fp == nullptr) return false;
+	fprintf(fp, "size %g\norigin %g %g\ngrid %d %d\n", tileSize, minX, minZ, gx, gz);
+
+	// vertices are renumbered within each tile; "local" is reset after it
+	//
+	vector<int> local(numVerts, -1);
+	bool normals = mesh.getNumNormals() == numVerts;
+	bool texCoords = mesh.getNumTexCoords() == numVerts;
+	for (int key = 0; key < gx * gz; key++) {
+		const vector<int> & faces = cellFaces[key];
+		if (faces.empty()) continue;
+		ofMesh tile;
+		vector<int> used;
+		ofVec3f lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (int f = 0; f < faces.size(); f++) {
+			for (int k = 0; k < 3; k++) {
+				int v = vertex(faces[f], k);
+				if (local[v] < 0) {
+					local[v] = tile.getNumVertices();
+					used.push_back(v);
+					ofVec3f p = mesh.getVertex(v);
+					tile.addVertex(p);
+					if (normals) tile.addNormal(mesh.getNormal(v));
+					if (texCoords) tile.addTexCoord(mesh.getTexCoord(v));
+					lo.x = std::min(lo.x, p.x); lo.y = std::min(lo.y, p.y); lo.z = std::min(lo.z, p.z);
+					hi.x = std::max(hi.x, p.x); hi.y = std::max(hi.y, p.y); hi.z = std::max(hi.z, p.z);
+				}
+				tile.addIndex(local[v]);
+			}
+		}
+		for (int i = 0; i < used.size(); i++) local[used[i]] = -1;
+
+		int i = key % gx, j = key / gx;
+		tile.save(dir + "/tile_" + to_string(i) + "_" + to_string(j) + ".ply");
+		fprintf(fp, "tile %d %d %g %g %g %g %g %g\n", i, j, lo.x, lo.y, lo.z, hi.x, hi.y, hi.z);
+	}
+	fclose(fp);
+	cout << "Split terrain into " << gx << " x " << gz << " tiles of " << tileSize << " in " << dir << endl;
+	return true;
+}
+
+// open:  read the tiles.txt of "dir" and start the loader thread
+//
+bool TerrainTiles::open(const string & path) {
+	close();
+	FILE *fp = fopen((path + "/tiles.txt").c_str(), "r");
+	if (fp == nullptr) return false;
+	bool ok = fscanf(fp, " size %f origin %f %f grid %d %d", &tileSize, &originX, &originZ, &gridX, &gridZ) == 5 &&
+		gridX > 0 && gridZ > 0;
+	if (ok) {
+		tileBoxes.assign(gridX * gridZ, Box());
+		tileExists.assign(gridX * gridZ, 0);
+		int i, j;
+		float b[6];
+		while (fscanf(fp, " tile %d %d %f %f %f %f %f %f", &i, &j, &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) == 8) {
+			if (i < 0 || j < 0 || i >= gridX || j >= gridZ) continue;
+			tileBoxes[j * gridX + i] = Box(Vector3(b[0], b[1], b[2]), Vector3(b[3], b[4], b[5]));
+			tileExists[j * gridX + i] = 1;
+		}
+	}
+	fclose(fp);
+	if (!ok) return false;
+
+	dir = path;
+	bQuit = false;
+	loader = thread(&TerrainTiles::loadTiles, this);
+	return true;
+}
+
+// close:  stop the loader and drop all tiles
+//
+void TerrainTiles::close() {
+	if (loader.joinable()) {
+		{
+			lock_guard<mutex> guard(lock);
+			bQuit = true;
+		}
+		wake.notify_all();
+		loader.join();
+	}
+	requests.clear();
+	pending.clear();
+	finished.clear();
+	tiles.clear();
+	lru.clear();
+}
+
+string TerrainTiles::tilePath(int key, const char *suffix) const {
+	return dir + "/tile_" + to_string(key % gridX) + "_" + to_string(key / gridX) + suffix;
+}
+
+Box TerrainTiles::tileBounds(int key) const {
+	return tileBoxes[key];
+}
+
+// loadTiles:  the loader thread.  Takes the nearest requested tile, reads
+//             its mesh and builds its octrees (or maps their caches, which
+//             are written next to the tile on its first load), and hands it
+//             to the main thread.
+//
+void TerrainTiles::loadTiles() {
+	while (true) {
+		int key;
+		{
+			unique_lock<mutex> guard(lock);
+			wake.wait(guard, [this]() { return bQuit || !requests.empty(); });
+			if (bQuit) return;
+			key = requests.front();
+			requests.pop_front();
+		}
+
+		shared_ptr<TerrainTile> tile = make_shared<TerrainTile>();
+		tile->key = key;
+		tile->bounds = tileBounds(key);
+		tile->mesh.load(tilePath(key, ".ply"));		// ofMesh::load() doesn't say if it failed
+		if (tile->mesh.getNumVertices() > 0) {
+			tile->faceTree.bUseFaces = true;
+			tile->faceTree.bKeepTree = false;
+			tile->faceTree.createCached(tilePath(key, "-faces.octree"), MeshView(tile->mesh), MaxTileLevels);
+			tile->pointTree.maxLeafPoints = 8;
+			tile->pointTree.bKeepTree = false;
+			tile->pointTree.bPackVertices = true;		// to move its points, see displace()
+			tile->pointTree.createCached(tilePath(key, ".octree"), MeshView(tile->mesh), MaxTileLevels);
+		}
+		else cout << "Could not load terrain tile " << tilePath(key, ".ply") << endl;
+
+		lock_guard<mutex> guard(lock);
+		pending.erase(key);
+		finished.push_back(tile);
+	}
+}
+
+// update:  call once a frame with the points to page the terrain around
+//          (lander, camera).  Takes the tiles the loader finished, requests
+//          the wanted tiles that are missing, nearest first, drops requests
+//          that are no longer wanted, uploads at most maxUploadsPerFrame
+//          tiles and evicts the least recently used beyond maxTiles.
+//
+void TerrainTiles::update(const vector<ofVec3f> & focus) {
+	if (gridX == 0) return;
+	vector<shared_ptr<TerrainTile>> ready;
+	{
+		lock_guard<mutex> guard(lock);
+		ready.swap(finished);
+	}
+	for (int i = 0; i < ready.size(); i++) {
+		int key = ready[i]->key;
+		if (tiles.count(key)) continue;
+		lru.push_front(key);
+		ready[i]->lruPos = lru.begin();
+		tiles[key] = ready[i];
+		tilesLoaded++;
+	}
+
+	// wanted tiles: grid cells within loadRadius of a focus point (in x, z)
+	//
+	map<int, float> wanted;
+	for (int f = 0; f < focus.size(); f++) {
+		int i0 = std::max(0, (int)floorf((focus[f].x - loadRadius - originX) / tileSize));
+		int i1 = std::min(gridX - 1, (int)floorf((focus[f].x + loadRadius - originX) / tileSize));
+		int j0 = std::max(0, (int)floorf((focus[f].z - loadRadius - originZ) / tileSize));
+		int j1 = std::min(gridZ - 1, (int)floorf((focus[f].z + loadRadius - originZ) / tileSize));
+		for (int j = j0; j <= j1; j++) {
+			for (int i = i0; i <= i1; i++) {
+				int key = j * gridX + i;
+				if (!tileExists[key]) continue;
+				float x0 = originX + i * tileSize, z0 = originZ + j * tileSize;
+				float dx = std::max(std::max(x0 - focus[f].x, focus[f].x - (x0 + tileSize)), 0.0f);
+				float dz = std::max(std::max(z0 - focus[f].z, focus[f].z - (z0 + tileSize)), 0.0f);
+				float d = sqrtf(dx * dx + dz * dz);
+				if (d > loadRadius) continue;
+				if (!wanted.count(key) || d < wanted[key]) wanted[key] = d;
+			}
+		}
+	}
+
+	vector<pair<float, int>> missing;
+	for (auto w = wanted.begin(); w != wanted.end(); w++) {
+		auto t = tiles.find(w->first);
+		if (t != tiles.end()) lru.splice(lru.begin(), lru, t->second->lruPos);
+		else missing.push_back(make_pair(w->second, w->first));
+	}
+	sort(missing.begin(), missing.end());
+	{
+		lock_guard<mutex> guard(lock);
+		for (auto r = requests.begin(); r != requests.end();) {
+			if (wanted.count(*r)) r++;
+			else {
+				pending.erase(*r);
+				r = requests.erase(r);
+			}
+		}
+		for (int i = 0; i < missing.size(); i++) {
+			if (pending.insert(missing[i].second).second) requests.push_back(missing[i].second);
+		}
+	}
+	if (!missing.empty()) wake.notify_one();
+
+	int uploads = 0;
+	for (auto l = lru.begin(); l != lru.end() && uploads < maxUploadsPerFrame; l++) {
+		TerrainTile & tile = *tiles[*l];
+		if (tile.bUploaded) continue;
+		tile.vbo.setMesh(tile.mesh, GL_STATIC_DRAW);
+		tile.bUploaded = true;
+		uploads++;
+	}
+
+	while (tiles.size() > maxTiles && !wanted.count(lru.back())) {
+		tiles.erase(lru.back());
+		lru.pop_back();
+		tilesEvicted++;
+	}
+}
+
+// draw:  the resident tiles that have been uploaded
+//
+void TerrainTiles::draw() {
+	for (auto t = tiles.begin(); t != tiles.end(); t++) {
+		if (t->second->bUploaded) t->second->vbo.drawElements(GL_TRIANGLES, t->second->vbo.getNumIndices());
+	}
+}
+
+// build:  SpatialIndex entry point, split "mesh" into tiles in dir (the
+//         data folder's "tiles" if none was set) and open them.  The tiles'
+//         octrees are built by the loader thread as they are paged in.
+//
+void TerrainTiles::build(const ofMesh & mesh, int /*numThreads*/) {
+	string path = dir.empty() ? ofToDataPath("tiles") : dir;
+	if (split(mesh, path, tileSize)) open(path);
+}
+
+// resident tiles whose bounds "ray" enters inside (tMin, tMax), nearest first
+//
+void TerrainTiles::sortByEntry(const Ray & ray, float tMin, float tMax, vector<pair<float, const TerrainTile *>> & tilesRtn) const {
+	tilesRtn.clear();
+	for (auto t = tiles.begin(); t != tiles.end(); t++) {
+		float tEnter;
+		if (t->second->bounds.intersect(ray, tMin, tMax, tEnter)) tilesRtn.push_back(make_pair(tEnter, t->second.get()));
+	}
+	sort(tilesRtn.begin(), tilesRtn.end(), [](const pair<float, const TerrainTile *> & a, const pair<float, const TerrainTile *> & b) {
+		return a.first < b.first;
+	});
+}
+
+// intersect:  closest hit over the resident tiles, stopping at the first
+//             tile entered beyond the best hit so far
+//
+bool TerrainTiles::intersect(const Ray & ray, RayHit & hit, float tMin, float tMax) const {
+	return intersect(ray, hit, tMin, tMax, QueryContext::local());
+}
+
+bool TerrainTiles::intersect(const Ray & ray, RayHit & hit, float tMin, float tMax, QueryContext & context) const {
+	hit = RayHit();
+	vector<pair<float, const TerrainTile *>> & order = context.tiles;
+	sortByEntry(ray, tMin, tMax, order);
+	bool found = false;
+	float best = tMax;
+	for (int i = 0; i < order.size() && order[i].first < best; i++) {
+		RayHit h;
+		if (order[i].second->faceTree.intersect(ray, h, tMin, best) && h.t < best) {
+			hit = h;
+			best = h.t;
+			found = true;
+		}
+	}
+	return found;
+}
+
+bool TerrainTiles::intersect(const Box & box, vector<Box> & boxListRtn) const {
+	bool intersects = false;
+	for (auto t = tiles.begin(); t != tiles.end(); t++) {
+		if (t->second->bounds.overlap(box) && t->second->faceTree.intersect(box, boxListRtn)) intersects = true;
+	}
+	return intersects;
+}
+
+bool TerrainTiles::intersectTop(const Box & box, float & topRtn, int maxDepth) const {
+	bool found = false;
+	for (auto t = tiles.begin(); t != tiles.end(); t++) {
+		float top;
+		if (!t->second->bounds.overlap(box) || !t->second->faceTree.intersectTop(box, top, maxDepth)) continue;
+		if (!found || top > topRtn) topRtn = top;
+		found = true;
+	}
+	return found;
+}
+
+// intersectSwept:  earliest contact over the resident tiles the swept box
+//                  reaches, from their face octrees
+//
+bool TerrainTiles::intersectSwept(const Box & box, const Vector3 & move, RayHit & hit) const {
+	hit = RayHit();
+	hit.t = 1;
+	Vector3 half = (box.max() - box.min()) / 2;
+	Ray ray(box.center(), move);
+	bool found = false;
+	for (auto t = tiles.begin(); t != tiles.end(); t++) {
+		const Box & b = t->second->bounds;
+		if (!Box(b.min() - half, b.max() + half).intersect(ray, 0, hit.t)) continue;
+		RayHit h;
+		if (t->second->faceTree.intersectSwept(box, move, h) && h.t < hit.t) {
+			hit = h;
+			found = true;
+		}
+	}
+	return found;
+}
+
+// knn:  the k nearest vertices over the resident tiles, visiting tiles by
+//       the distance to their bounds and stopping at one farther than the
+//       k-th nearest found
+//
+int TerrainTiles::knn(const ofVec3f & p, int k, vector<PointHit> & hits) const {
+	return knn(p, k, hits, QueryContext::local());
+}
+
+int TerrainTiles::knn(const ofVec3f & p, int k, vector<PointHit> & hits, QueryContext & context) const {
+	hits.clear();
+	if (k <= 0) return 0;
+	vector<pair<float, const TerrainTile *>> & order = context.tiles;
+	order.clear();
+	for (auto t = tiles.begin(); t != tiles.end(); t++) {
+		const Box & b = t->second->bounds;
+		float d2 = 0;
+		for (int a = 0; a < 3; a++) {
+			float lo = b.min()[a], hi = b.max()[a];
+			float d = p[a] < lo ? lo - p[a] : p[a] > hi ? p[a] - hi : 0;
+			d2 += d * d;
+		}
+		order.push_back(make_pair(sqrtf(d2), t->second.get()));
+	}
+	sort(order.begin(), order.end(), [](const pair<float, const TerrainTile *> & a, const pair<float, const TerrainTile *> & b) {
+		return a.first < b.first;
+	});
+
+	// a vertex on a tile border is in both tiles; keep one copy of it.
+	// The copies are the same distance away (up to rounding), so only the
+	// few hits next to the insertion point can be one.  The tile's knn()
+	// reuses the context's queues, not these buffers.
+	//
+	vector<PointHit> & tileHits = context.tileHits;
+	vector<ofVec3f> & positions = context.positions;
+	positions.clear();
+	for (int i = 0; i < order.size(); i++) {
+		if (hits.size() == k && order[i].first >= hits.back().dist) break;
+		const Octree & tree = order[i].second->pointTree;
+		tree.knn(p, k, tileHits, context);
+		for (int h = 0; h < tileHits.size(); h++) {
+			ofVec3f v = tree.view.vertex(tileHits[h].index);
+
+			// insert in distance order, keeping at most k
+			int at = hits.size();
+			while (at > 0 && hits[at - 1].dist > tileHits[h].dist) at--;
+			float d = tileHits[h].dist, tol = 1e-5f * std::max(1.0f, d);
+			bool copy = false;
+			for (int j = at - 1; j >= 0 && hits[j].dist >= d - tol && !copy; j--) copy = positions[j] == v;
+			for (int j = at; j < hits.size() && hits[j].dist <= d + tol && !copy; j++) copy = positions[j] == v;
+			if (copy || at >= k) continue;
+			hits.insert(hits.begin() + at, tileHits[h]);
+			positions.insert(positions.begin() + at, v);
+			if (hits.size() > k) {
+				hits.pop_back();
+				positions.pop_back();
+			}
+		}
+	}
+	return hits.size();
+}
+
+// displace:  move the vertices of the resident tiles inside "area" with
+//             "move", which changes a position and returns true (or false
+//             to leave it), and update the tiles' octrees and vertex
+//             buffers.  A tile's point octree is rebuilt if a point leaves
+//             its box, as a tile is small.  The edits last while a tile is
+//             resident; an evicted tile is read again from its file.
+//             Returns the number of vertices moved.
+//
+int TerrainTiles::displace(const Box & area, const function<bool(ofVec3f &)> & move) {
+	int moved = 0;
+	for (auto t = tiles.begin(); t != tiles.end(); t++) {
+		TerrainTile & tile = *t->second;
+		if (tile.pointTree.numNodes == 0 || !tile.bounds.overlap(area)) continue;
+		vector<int> candidates;
+		tile.pointTree.getPointsInBox(area, candidates);
+
+		vector<int> verts;
+		vector<ofVec3f> pos;
+		int lo = INT_MAX, hi = -1;
+		ofVec3f bmin(tile.bounds.min().x(), tile.bounds.min().y(), tile.bounds.min().z());
+		ofVec3f bmax(tile.bounds.max().x(), tile.bounds.max().y(), tile.bounds.max().z());
+		for (int i = 0; i < candidates.size(); i++) {
+			ofVec3f p = tile.mesh.getVertex(candidates[i]);
+			if (!move(p)) continue;
+			verts.push_back(candidates[i]);
+			pos.push_back(p);
+			lo = std::min(lo, candidates[i]);
+			hi = std::max(hi, candidates[i]);
+			bmin.x = std::min(bmin.x, p.x); bmin.y = std::min(bmin.y, p.y); bmin.z = std::min(bmin.z, p.z);
+			bmax.x = std::max(bmax.x, p.x); bmax.y = std::max(bmax.y, p.y); bmax.z = std::max(bmax.z, p.z);
+		}
+		if (verts.empty()) continue;
+
+		// the face octree reads the tile's mesh, so it is moved first
+		//
+		for (int i = 0; i < verts.size(); i++) tile.mesh.setVertex(verts[i], pos[i]);
+		tile.faceTree.moveVertices(verts, pos);
+		if (!tile.pointTree.moveVertices(verts, pos)) tile.pointTree.create(MeshView(tile.mesh), MaxTileLevels);
+		tile.bounds = Box(Vector3(bmin.x, bmin.y, bmin.z), Vector3(bmax.x, bmax.y, bmax.z));
+		if (tile.bUploaded) {
+			tile.vbo.getVertexBuffer().updateData(lo * sizeof(glm::vec3), (hi - lo + 1) * sizeof(glm::vec3),
+				tile.mesh.getVerticesPointer() + lo);
+		}
+		moved += verts.size();
+	}
+	return moved;
+}
+
+size_t TerrainTiles::memoryUsage() const {
+	size_t bytes = 0;
+	for (auto t = tiles.begin(); t != tiles.end(); t++) bytes += t->second->memoryUsage();
+	return bytes;
+}
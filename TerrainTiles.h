@@ -0,0 +1,99 @@
+//--------------------------------------------------------------
+//
+//  TerrainTiles:  a terrain too large to hold at once, stored as a grid of
+//  tiles (a PLY mesh each, see split()) and paged in around the lander and
+//  camera.  Tiles are loaded, and their octrees built or read from their
+//  caches, on a background thread; the main thread only takes the finished
+//  tiles and uploads their meshes, so a load never stalls a frame.  The
+//  least recently used tiles are evicted beyond maxTiles.
+//
+//  As a SpatialIndex the tiles answer the app's queries across tile
+//  borders, from the tiles that are resident.
+//
+#pragma once
+#include "Octree.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <set>
+#include <functional>
+
+//  One resident tile: its mesh, a face octree (rays, boxes) and a point
+//  octree (knn) that both read the mesh in place, and the mesh's VBO.
+//
+class TerrainTile {
+public:
+	int key = -1;				// j * gridX + i
+	Box bounds;
+	ofMesh mesh;
+	Octree faceTree;
+	Octree pointTree;
+	ofVbo vbo;					// uploaded on the main thread
+	bool bUploaded = false;
+	list<int>::iterator lruPos;
+
+	size_t memoryUsage() const;
+};
+
+class TerrainTiles : public SpatialIndex {
+public:
+	~TerrainTiles();
+
+	static bool split(const ofMesh & mesh, const string & dir, float tileSize);
+	bool open(const string & dir);
+	void close();
+	void update(const vector<ofVec3f> & focus);
+	void draw();
+	void loadTiles();
+	string tilePath(int key, const char *suffix) const;
+	Box tileBounds(int key) const;
+	int displace(const Box & area, const function<bool(ofVec3f &)> & move);
+	void sortByEntry(const Ray & ray, float tMin, float tMax, vector<pair<float, const TerrainTile *>> & tilesRtn) const;
+
+	// SpatialIndex.  build() splits "mesh" into tiles in dir and opens
+	// them.  PointHit and RayHit indices are within the tile that was hit,
+	// so moveVertices() can't name a vertex and does nothing: the resident
+	// tiles are edited by position with displace().
+	//
+	void build(const ofMesh & mesh, int numThreads = 1);
+	bool intersect(const Ray &, RayHit & hit, float tMin = 0, float tMax = FLT_MAX) const;
+	bool intersect(const Ray &, RayHit & hit, float tMin, float tMax, QueryContext & context) const;
+	bool intersect(const Box &, vector<Box> & boxListRtn) const;
+	bool intersectTop(const Box &, float & topRtn, int maxDepth = INT_MAX) const;
+	bool intersectSwept(const Box &, const Vector3 & move, RayHit & hit) const;
+	int knn(const ofVec3f & p, int k, vector<PointHit> & hits) const;
+	int knn(const ofVec3f & p, int k, vector<PointHit> & hits, QueryContext & context) const;
+	bool moveVertices(const vector<int> & /*verts*/, const vector<ofVec3f> & /*pos*/) { return false; }
+	size_t memoryUsage() const;
+	const char *name() const { return "tiles"; }
+
+	// the grid, from the tiles.txt file written by split()
+	//
+	string dir;
+	float tileSize = 100;
+	float originX = 0, originZ = 0;
+	int gridX = 0, gridZ = 0;
+	vector<Box> tileBoxes;			// bounds of the tile mesh in each grid cell
+	vector<char> tileExists;		// cells with no triangles have no tile
+
+	float loadRadius = 150;			// tiles within this of a focus point are wanted
+	int maxTiles = 16;				// resident tiles kept, at least the wanted ones
+	int maxUploadsPerFrame = 1;
+
+	// main thread: resident tiles, most recently used first in lru
+	//
+	map<int, shared_ptr<TerrainTile>> tiles;
+	list<int> lru;
+	int tilesLoaded = 0, tilesEvicted = 0;
+
+	// shared with the loader thread
+	//
+	thread loader;
+	mutex lock;
+	condition_variable wake;
+	deque<int> requests;
+	set<int> pending;				// requested or loading
+	vector<shared_ptr<TerrainTile>> finished;
+	bool bQuit = false;
+};
@@ -0,0 +1,780 @@
+//--------------------------------------------------------------
+//
+//  OctreeBench:  headless benchmark of the terrain indices on synthetic
+//  terrains, for tracking performance between versions.
+//
+//  Each terrain (fractal heightfield, uniform cloud of small triangles,
+//  clustered craters) is generated at each size and indexed by a point
+//  octree (built up front and lazily), a face octree, a Bvh and a
+//  brute-force scan.  For each index it measures the build time and the
+//  peak memory the build used, then ray, box (intersectTop), box list
+//  (intersect(Box, boxes)) and nearest-vertex queries: throughput and the 50th and 99th percentile
+//  latency, and the index size after them.  The brute force is the
+//  baseline; it runs only the first few hundred queries, and the other
+//  indices' answers to those are checked against it.  The octrees also
+//  trace coherent rays (16 from one point to a small patch of the floor)
+//  one at a time and in packets of 4, 8 and 16; the packets' answers are
+//  checked against the single rays'.  The point and face octrees are then
+//  copied into CompactOctrees, whose size and ray and box query rates are
+//  measured with their answers checked against the octree they came from.
+//
+//  The bench opens no window.  Build it as its own openFrameworks project
+//  (projectGenerator, no addons) from this file and ../Octree.cpp,
+//  ../Bvh.cpp, ../SpatialIndex.cpp and ../box.cc, with the parent
+//  directory on the include path.
+//
+//      OctreeBench [--sizes 10000,100000,1000000,10000000]
+//                  [--terrains fractal,cloud,craters] [--queries 20000]
+//                  [--threads 1] [--out bench.json] [--baseline old.json]
+//                  [--tolerance 10]
+//
+//  The results are written as JSON, one line per terrain, size and index.
+//  With --baseline, the query rates are compared with the matching lines
+//  of an earlier run.  Any that dropped by more than the tolerance (in
+//  percent) are listed, and the bench then exits with status 1.
+//
+#include "ofMain.h"
+#include "Octree.h"
+#include "OctreeSimd.h"
+#include "Bvh.h"
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <map>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#endif
+
+// resident memory of the process in bytes
+//
+static size_t residentBytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return pmc.WorkingSetSize;
+	return 0;
+#elif defined(__APPLE__)
+	mach_task_basic_info info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS)
+		return info.resident_size;
+	return 0;
+#else
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (!fp) return 0;
+	long pages = 0, resident = 0;
+	if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) resident = 0;
+	fclose(fp);
+	return (size_t)resident * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+// samples the resident memory every millisecond between start() and
+// stop(); peak() is the most it rose above where it was at start()
+//
+class MemorySampler {
+public:
+	void start() {
+		base = max = residentBytes();
+		bStop = false;
+		sampler = thread([this]() {
+			while (!bStop) {
+				size_t now = residentBytes();
+				if (now > max) max = now;
+				this_thread::sleep_for(chrono::milliseconds(1));
+			}
+		});
+	}
+	void stop() {
+		bStop = true;
+		sampler.join();
+		size_t now = residentBytes();
+		if (now > max) max = now;
+	}
+	size_t peak() const { return max > base ? max - base : 0; }
+
+	thread sampler;
+	atomic<bool> bStop{ false };
+	atomic<size_t> max{ 0 };
+	size_t base = 0;
+};
+
+static double nowUs() {
+	return chrono::duration<double, micro>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//  Synthetic terrains.  All span about 1000 x 1000 units in x and z.
+//
+
+// value noise: smoothly interpolated random heights on an integer lattice
+//
+static float lattice(int x, int z, unsigned seed) {
+	unsigned h = (unsigned)x * 73856093u ^ (unsigned)z * 19349663u ^ seed * 83492791u;
+	h ^= h >> 13;
+	h *= 0x5bd1e995u;
+	h ^= h >> 15;
+	return (h & 0xffffff) / (float)0xffffff;
+}
+
+static float valueNoise(float x, float z, unsigned seed) {
+	int x0 = (int)floorf(x), z0 = (int)floorf(z);
+	float fx = x - x0, fz = z - z0;
+	fx = fx * fx * (3 - 2 * fx);
+	fz = fz * fz * (3 - 2 * fz);
+	float a = lattice(x0, z0, seed), b = lattice(x0 + 1, z0, seed);
+	float c = lattice(x0, z0 + 1, seed), d = lattice(x0 + 1, z0 + 1, seed);
+	return (a + (b - a) * fx) + ((c + (d - c) * fx) - (a + (b - a) * fx)) * fz;
+}
+
+// fractal (fBm) height: six octaves of value noise, about 0..100 units
+//
+static float fractalHeight(float x, float z) {
+	float h = 0, amp = 60, freq = 1 / 200.0f;
+	for (int o = 0; o < 6; o++) {
+		h += amp * valueNoise(x * freq, z * freq, o);
+		amp *= 0.5f;
+		freq *= 2;
+	}
+	return h;
+}
+
+// add a side x side grid of vertices over [x0, x0 + size] x [z0, z0 + size]
+// with heights height(x, z), two triangles per cell
+//
+template <class F>
+static void addGrid(ofMesh & mesh, float x0, float z0, float size, int side, F height) {
+	int first = mesh.getNumVertices();
+	float step = size / (side - 1);
+	for (int j = 0; j < side; j++) {
+		for (int i = 0; i < side; i++) {
+			float x = x0 + i * step, z = z0 + j * step;
+			mesh.addVertex(ofVec3f(x, height(x, z), z));
+		}
+	}
+	for (int j = 0; j + 1 < side; j++) {
+		for (int i = 0; i + 1 < side; i++) {
+			int a = first + j * side + i, b = a + 1, c = a + side, d = c + 1;
+			mesh.addIndex(a); mesh.addIndex(c); mesh.addIndex(b);
+			mesh.addIndex(b); mesh.addIndex(c); mesh.addIndex(d);
+		}
+	}
+}
+
+static int gridSide(int numVertices) {
+	return std::max(2, (int)sqrtf((float)numVertices));
+}
+
+// fractal:  one regular grid with fractal heights, the terrain the app has
+//
+static void makeFractal(ofMesh & mesh, int numVertices) {
+	addGrid(mesh, -500, -500, 1000, gridSide(numVertices), fractalHeight);
+}
+
+// cloud:  small triangles scattered uniformly through a 1000 x 100 x 1000
+//         box, three vertices each; no surface, just uniform density
+//
+static void makeCloud(ofMesh & mesh, int numVertices) {
+	int numTris = std::max(1, numVertices / 3);
+	float spacing = cbrtf(1000.0f * 100.0f * 1000.0f / numTris);
+	for (int t = 0; t < numTris; t++) {
+		ofVec3f c(ofRandom(-500, 500), ofRandom(0, 100), ofRandom(-500, 500));
+		mesh.addVertex(c);
+		mesh.addVertex(c + ofVec3f(ofRandom(-1, 1), ofRandom(-1, 1), ofRandom(-1, 1)) * spacing * 0.5f);
+		mesh.addVertex(c + ofVec3f(ofRandom(-1, 1), ofRandom(-1, 1), ofRandom(-1, 1)) * spacing * 0.5f);
+	}
+}
+
+// craters:  a coarse fractal grid with a quarter of the vertices and 64
+//           crater patches, fine grids over the coarse one, with the rest;
+//           the density varies about 100 to 1 across the terrain
+//
+static void makeCraters(ofMesh & mesh, int numVertices) {
+	addGrid(mesh, -500, -500, 1000, gridSide(numVertices / 4), fractalHeight);
+	const int numCraters = 64;
+	int side = gridSide(numVertices * 3 / 4 / numCraters);
+	for (int k = 0; k < numCraters; k++) {
+		float cx = ofRandom(-450, 450), cz = ofRandom(-450, 450), r = ofRandom(10, 40), depth = r * 0.3f;
+		addGrid(mesh, cx - r, cz - r, 2 * r, side, [=](float x, float z) {
+			float d2 = ((x - cx) * (x - cx) + (z - cz) * (z - cz)) / (r * r);
+			float bowl = d2 < 1 ? -depth * (1 - d2) : depth * 0.2f * expf(-(d2 - 1) * 4);
+			return fractalHeight(x, z) + bowl;
+		});
+	}
+}
+
+//  Brute-force baseline: every query scans the whole mesh.
+//
+class BruteForce : public SpatialIndex {
+public:
+	void build(const ofMesh & geo, int /*numThreads*/ = 1) { mesh = MeshView(geo); }
+
+	// closest triangle hit (Moller-Trumbore, both sides), as the face octree
+	//
+	bool intersect(const Ray & ray, RayHit & hit, float tMin = 0, float tMax = FLT_MAX) const {
+		float o[3] = { ray.origin.x(), ray.origin.y(), ray.origin.z() };
+		float d[3] = { ray.direction.x(), ray.direction.y(), ray.direction.z() };
+		hit = RayHit();
+		hit.t = tMax;
+		for (int f = 0; f < mesh.numFaces(); f++) {
+			ofVec3f v0 = mesh.vertex(mesh.faceVertex(f, 0));
+			ofVec3f e1 = mesh.vertex(mesh.faceVertex(f, 1)) - v0, e2 = mesh.vertex(mesh.faceVertex(f, 2)) - v0;
+			float p[3] = { d[1] * e2.z - d[2] * e2.y, d[2] * e2.x - d[0] * e2.z, d[0] * e2.y - d[1] * e2.x };
+			float det = e1.x * p[0] + e1.y * p[1] + e1.z * p[2];
+			if (det > -1e-12f && det < 1e-12f) continue;
+			float inv = 1 / det;
+			float s[3] = { o[0] - v0.x, o[1] - v0.y, o[2] - v0.z };
+			float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+			if (u < 0 || u > 1) continue;
+			float q[3] = { s[1] * e1.z - s[2] * e1.y, s[2] * e1.x - s[0] * e1.z, s[0] * e1.y - s[1] * e1.x };
+			float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv;
+			if (v < 0 || u + v > 1) continue;
+			float t = (e2.x * q[0] + e2.y * q[1] + e2.z * q[2]) * inv;
+			if (t <= tMin || t >= hit.t) continue;
+			hit.t = t;
+			hit.index = f;
+			hit.u = u;
+			hit.v = v;
+		}
+		if (hit.index < 0) return false;
+		hit.point = ray.origin + ray.direction * hit.t;
+		return true;
+	}
+	// a point box for each vertex inside "box"
+	//
+	bool intersect(const Box & box, vector<Box> & boxListRtn) const {
+		bool found = false;
+		for (int i = 0; i < mesh.numVertices; i++) {
+			ofVec3f v = mesh.vertex(i);
+			Vector3 p(v.x, v.y, v.z);
+			if (!box.inside(p)) continue;
+			boxListRtn.push_back(Box(p, p));
+			found = true;
+		}
+		return found;
+	}
+
+	// highest vertex inside "box"
+	//
+	bool intersectTop(const Box & box, float & topRtn, int /*maxDepth*/ = INT_MAX) const {
+		bool found = false;
+		topRtn = -FLT_MAX;
+		for (int i = 0; i < mesh.numVertices; i++) {
+			ofVec3f v = mesh.vertex(i);
+			if (!box.inside(Vector3(v.x, v.y, v.z))) continue;
+			topRtn = std::max(topRtn, v.y);
+			found = true;
+		}
+		return found;
+	}
+
+	// the k nearest vertices by insertion into a sorted list
+	//
+	int knn(const ofVec3f & p, int k, vector<PointHit> & hits) const {
+		hits.clear();
+		for (int i = 0; i < mesh.numVertices; i++) {
+			float d = mesh.vertex(i).distance(p);
+			if (hits.size() == k && d >= hits.back().dist) continue;
+			if (hits.size() == k) hits.pop_back();
+			PointHit h;
+			h.index = i;
+			h.dist = d;
+			hits.insert(upper_bound(hits.begin(), hits.end(), h,
+				[](const PointHit & a, const PointHit & b) { return a.dist < b.dist; }), h);
+		}
+		return hits.size();
+	}
+	// earliest contact of the swept box with any triangle, as the face octree
+	//
+	bool intersectSwept(const Box & box, const Vector3 & move, RayHit & hit) const {
+		hit = RayHit();
+		hit.t = 1;
+		for (int f = 0; f < mesh.numFaces(); f++) {
+			Vector3 tri[3];
+			for (int k = 0; k < 3; k++) {
+				ofVec3f v = mesh.vertex(mesh.faceVertex(f, k));
+				tri[k] = Vector3(v.x, v.y, v.z);
+			}
+			float t;
+			Vector3 normal;
+			if (!sweepTriangle(box, move, tri, t, normal) || t >= hit.t) continue;
+			hit.t = t;
+			hit.index = f;
+			hit.normal = normal;
+		}
+		if (hit.index < 0) return false;
+		hit.point = box.center() + move * hit.t;
+		return true;
+	}
+	bool moveVertices(const vector<int> & /*verts*/, const vector<ofVec3f> & /*pos*/) { return false; }
+	size_t memoryUsage() const { return 0; }
+	const char *name() const { return "brute force"; }
+
+	MeshView mesh;
+};
+
+//  Timing of one kind of query
+//
+class QueryStats {
+public:
+	bool bRun = false;
+	int count = 0;
+	double qps = 0, p50 = 0, p99 = 0;	// queries/s, latency in microseconds
+	int hits = 0;
+	int errors = 0;						// answers that disagree with the brute force
+
+	// time query(i) for i in [0, n), one clock read per query; qps counts
+	// "perQuery" queries (rays of a packet) for each call
+	//
+	template <class F>
+	void run(int n, F query, int perQuery = 1) {
+		vector<double> us(n);
+		double total = 0;
+		for (int i = 0; i < n; i++) {
+			double start = nowUs();
+			hits += query(i);
+			us[i] = nowUs() - start;
+			total += us[i];
+		}
+		bRun = n > 0;
+		count = n * perQuery;
+		qps = total > 0 ? count / (total / 1e6) : 0;
+		if (n == 0) return;
+		nth_element(us.begin(), us.begin() + n / 2, us.end());
+		p50 = us[n / 2];
+		nth_element(us.begin(), us.begin() + (n * 99) / 100, us.end());
+		p99 = us[(n * 99) / 100];
+	}
+
+	void write(FILE *fp, const char *name) const {
+		if (!bRun) {
+			fprintf(fp, "\"%s\": null", name);
+			return;
+		}
+		fprintf(fp, "\"%s\": {\"queries\": %d, \"qps\": %.0f, \"p50_us\": %.3f, \"p99_us\": %.3f, \"hits\": %d, \"errors\": %d}",
+			name, count, qps, p50, p99, hits, errors);
+	}
+};
+
+// the queries every index answers on one terrain, those of
+// SpatialIndex::benchmark() (see BenchmarkQueries) and "coherent": groups of
+// 16 rays from one point above the terrain to a 4 x 4 grid on the floor,
+// 0.1% of the bounds apart; packets of 4 and 8 are rows and pairs of rows
+// of a group.
+//
+class QuerySet : public BenchmarkQueries {
+public:
+	void make(const ofMesh & mesh, int n) {
+		BenchmarkQueries::make(MeshView(mesh), n);
+		Vector3 lo = bounds.min(), hi = bounds.max();
+		Vector3 size = hi - lo;
+		for (int g = 0; g < n / 16; g++) {
+			Vector3 from(ofRandom(lo.x(), hi.x()), hi.y() + size.y(), ofRandom(lo.z(), hi.z()));
+			Vector3 to(ofRandom(lo.x(), hi.x()), lo.y(), ofRandom(lo.z(), hi.z()));
+			for (int k = 0; k < 16; k++) {
+				Vector3 d((k % 4) * size.x() * 0.001f, 0, (k / 4) * size.z() * 0.001f);
+				coherent.push_back(Ray(from, to + d - from));
+			}
+		}
+	}
+
+	vector<Ray> coherent;
+};
+
+// the brute force's answers to the first queries, to check the others by
+//
+class Reference {
+public:
+	vector<RayHit> rays;
+	vector<char> rayHit, boxHit, boxListHit;
+	vector<float> nearest;
+};
+
+// one line of a results file, by terrain, size and index
+//
+class Result {
+public:
+	string terrain, index;
+	int vertices = 0, triangles = 0;
+	double buildMs = 0;
+	size_t buildPeak = 0, memory = 0;
+	QueryStats ray, box, boxList, knn;
+	QueryStats coherent, packet[3];		// the coherent rays one at a time and in packets of 4, 8, 16
+
+	string key() const { return terrain + "/" + ofToString(vertices) + "/" + index; }
+};
+
+// benchmark one index on "mesh".  The brute force answers the first
+// "numRef" queries into "ref"; the other indices are checked against them.
+//
+static Result benchmark(SpatialIndex & index, const ofMesh & mesh, const QuerySet & queries, int numQueries,
+	int numThreads, Reference & ref, int numRef)
+{
+	Result r;
+	r.index = index.name();
+	r.vertices = mesh.getNumVertices();
+	r.triangles = MeshView(mesh).numFaces();
+	bool brute = dynamic_cast<BruteForce *>(&index) != nullptr;
+	Octree *octree = dynamic_cast<Octree *>(&index);
+
+	// the octrees index the mesh in place; the Bvh keeps a copy
+	//
+	MemorySampler memory;
+	streambuf *out = cout.rdbuf(nullptr);
+	memory.start();
+	double start = nowUs();
+	if (octree) octree->create(MeshView(mesh), 20, numThreads);
+	else index.build(mesh, numThreads);
+	r.buildMs = (nowUs() - start) / 1000;
+	memory.stop();
+	cout.rdbuf(out);
+	r.buildPeak = memory.peak();
+
+	int n = brute ? numRef : numQueries;
+	if (brute) {
+		ref.rays.resize(n);
+		ref.rayHit.resize(n);
+		ref.boxHit.resize(n);
+		ref.boxListHit.resize(n);
+		ref.nearest.resize(n);
+	}
+
+	// a point octree's ray query is the nearest leaf point, not a triangle,
+	// so only the triangle indices are checked on rays
+	//
+	bool triangles = !octree || octree->bUseFaces;
+	RayHit hit;
+	r.ray.run(n, [&](int i) {
+		bool h = index.intersect(queries.rays[i], hit);
+		if (brute) {
+			ref.rays[i] = hit;
+			ref.rayHit[i] = h;
+		}
+		return (int)h;
+	});
+	for (int i = 0; i < numRef && !brute && triangles; i++) {
+		bool h = index.intersect(queries.rays[i], hit);
+		if (h != (bool)ref.rayHit[i] || (h && fabsf(hit.t - ref.rays[i].t) > 1e-3f * std::max(1.0f, hit.t)))
+			r.ray.errors++;
+	}
+
+	// an index may report a box it only comes near (leaf boxes), but must
+	// report every box that holds a vertex
+	//
+	float top;
+	r.box.run(n, [&](int i) {
+		bool h = index.intersectTop(queries.boxes[i], top);
+		if (brute) ref.boxHit[i] = h;
+		return (int)h;
+	});
+	for (int i = 0; i < numRef && !brute; i++) {
+		if (ref.boxHit[i] && !index.intersectTop(queries.boxes[i], top)) r.box.errors++;
+	}
+
+	// the same for the leaf boxes the app draws for a mouse drag
+	//
+	vector<Box> boxList;
+	r.boxList.run(n, [&](int i) {
+		boxList.clear();
+		bool h = index.intersect(queries.boxes[i], boxList);
+		if (brute) ref.boxListHit[i] = h;
+		return (int)h;
+	});
+	for (int i = 0; i < numRef && !brute; i++) {
+		boxList.clear();
+		if (ref.boxListHit[i] && !index.intersect(queries.boxes[i], boxList)) r.boxList.errors++;
+	}
+
+	// a face octree holds no points, so it has no knn rate
+	//
+	vector<PointHit> nearest;
+	if (!octree || !octree->bUseFaces) {
+		r.knn.run(n, [&](int i) {
+			int found = index.knn(queries.points[i], 1, nearest);
+			if (brute) ref.nearest[i] = found ? nearest[0].dist : FLT_MAX;
+			return found;
+		});
+		for (int i = 0; i < numRef && !brute; i++) {
+			float d = index.knn(queries.points[i], 1, nearest) ? nearest[0].dist : FLT_MAX;
+			if (fabsf(d - ref.nearest[i]) > 1e-4f * std::max(1.0f, d)) r.knn.errors++;
+		}
+	}
+
+	// the coherent rays one by one and in packets; the packets must give
+	// the single rays' answers
+	//
+	if (octree) {
+		int numRays = queries.coherent.size();
+		vector<RayHit> single(numRays);
+		r.coherent.run(numRays, [&](int i) { return (int)octree->intersect(queries.coherent[i], single[i]); });
+		for (int p = 0; p < 3; p++) {
+			int size = 4 << p;
+			RayPacket packet;
+			RayHit hits[RayPacket::MaxRays];
+			r.packet[p].run(numRays / size, [&](int i) {
+				packet.clear();
+				for (int k = 0; k < size; k++) packet.add(queries.coherent[i * size + k]);
+				return octree->intersect(packet, hits);
+			}, size);
+			for (int i = 0; i < numRays / size; i++) {
+				packet.clear();
+				for (int k = 0; k < size; k++) packet.add(queries.coherent[i * size + k]);
+				octree->intersect(packet, hits);
+				for (int k = 0; k < size; k++) {
+					const RayHit & one = single[i * size + k];
+					if (hits[k].index != one.index || fabsf(hits[k].t - one.t) > 1e-5f * std::max(1.0f, one.t))
+						r.packet[p].errors++;
+				}
+			}
+		}
+	}
+
+	// after the queries, which a lazy octree's size depends on
+	//
+	r.memory = index.memoryUsage() + (octree ? octree->meshMemoryUsage() : 0);
+	return r;
+}
+
+// benchmark a CompactOctree made from "tree".  It may find more than the
+// octree (its boxes are rounded outward), so an error is a hit the octree
+// has and it misses, a triangle hit at another distance, or a lower top.
+//
+static Result benchmarkCompact(const Octree & tree, const QuerySet & queries, int numQueries) {
+	Result r;
+	r.index = string("compact ") + tree.name();
+	r.vertices = tree.view.numVertices;
+	r.triangles = tree.view.numFaces();
+
+	CompactOctree compact;
+	MemorySampler memory;
+	streambuf *out = cout.rdbuf(nullptr);
+	memory.start();
+	double start = nowUs();
+	compact.create(tree);
+	r.buildMs = (nowUs() - start) / 1000;
+	memory.stop();
+	cout.rdbuf(out);
+	r.buildPeak = memory.peak();
+
+	RayHit hit, treeHit;
+	r.ray.run(numQueries, [&](int i) { return (int)compact.intersect(queries.rays[i], hit); });
+	for (int i = 0; i < numQueries; i++) {
+		bool h = compact.intersect(queries.rays[i], hit);
+		if (!tree.intersect(queries.rays[i], treeHit)) continue;
+		if (!h || (tree.bUseFaces && fabsf(hit.t - treeHit.t) > 1e-5f * std::max(1.0f, treeHit.t))) r.ray.errors++;
+	}
+
+	float top, treeTop;
+	r.box.run(numQueries, [&](int i) { return (int)compact.intersectTop(queries.boxes[i], top); });
+	for (int i = 0; i < numQueries; i++) {
+		bool h = compact.intersectTop(queries.boxes[i], top);
+		if (!tree.intersectTop(queries.boxes[i], treeTop)) continue;
+		if (!h || top < treeTop) r.box.errors++;
+	}
+
+	// the mesh is not needed once the points are quantized, but a face
+	// octree's triangles are copied
+	//
+	r.memory = compact.memoryUsage();
+	return r;
+}
+
+// the kinds of query a results line has rates for, in the order of
+// readBaseline()'s rates
+//
+static const int NumKinds = 8;
+static const char *kinds[NumKinds] = { "ray", "box", "box_list", "knn", "coherent", "packet4", "packet8", "packet16" };
+
+static void writeResult(FILE *fp, const Result & r, bool last) {
+	fprintf(fp, "    {\"terrain\": \"%s\", \"vertices\": %d, \"triangles\": %d, \"index\": \"%s\", "
+		"\"build_ms\": %.3f, \"build_peak_bytes\": %zu, \"memory_bytes\": %zu, ",
+		r.terrain.c_str(), r.vertices, r.triangles, r.index.c_str(), r.buildMs, r.buildPeak, r.memory);
+	r.ray.write(fp, "ray");
+	fprintf(fp, ", ");
+	r.box.write(fp, "box");
+	fprintf(fp, ", ");
+	r.boxList.write(fp, "box_list");
+	fprintf(fp, ", ");
+	r.knn.write(fp, "knn");
+	fprintf(fp, ", ");
+	r.coherent.write(fp, "coherent");
+	for (int p = 0; p < 3; p++) {
+		fprintf(fp, ", ");
+		r.packet[p].write(fp, kinds[5 + p]);
+	}
+	fprintf(fp, "}%s\n", last ? "" : ",");
+}
+
+// the query rates of an earlier results file, by Result::key(); only reads
+// files written by writeResult()
+//
+static map<string, vector<double>> readBaseline(const string & path) {
+	map<string, vector<double>> rates;
+	FILE *fp = fopen(path.c_str(), "r");
+	if (!fp) {
+		cout << "Could not read baseline " << path << endl;
+		return rates;
+	}
+	auto field = [](const string & line, const string & name) -> string {
+		size_t p = line.find("\"" + name + "\": ");
+		if (p == string::npos) return "";
+		p += name.size() + 4;
+		if (line[p] == '"') return line.substr(p + 1, line.find('"', p + 1) - p - 1);
+		return line.substr(p, line.find_first_of(",}", p) - p);
+	};
+	char buf[4096];
+	while (fgets(buf, sizeof(buf), fp)) {
+		string line = buf;
+		if (line.find("\"terrain\"") == string::npos) continue;
+		string key = field(line, "terrain") + "/" + field(line, "vertices") + "/" + field(line, "index");
+		vector<double> & r = rates[key];
+		for (int k = 0; k < NumKinds; k++) {
+			size_t p = line.find(string("\"") + kinds[k] + "\": {");
+			r.push_back(p == string::npos ? 0 : atof(field(line.substr(p), "qps").c_str()));
+		}
+	}
+	fclose(fp);
+	return rates;
+}
+
+static vector<string> splitList(const string & s) {
+	vector<string> items;
+	size_t start = 0;
+	while (start <= s.size()) {
+		size_t end = s.find(',', start);
+		if (end == string::npos) end = s.size();
+		if (end > start) items.push_back(s.substr(start, end - start));
+		start = end + 1;
+	}
+	return items;
+}
+
+int main(int argc, char *argv[]) {
+	vector<string> sizes = { "10000", "100000", "1000000", "10000000" };
+	vector<string> terrains = { "fractal", "cloud", "craters" };
+	int numQueries = 20000;
+	int numThreads = 1;
+	float tolerance = 10;
+	string outPath = "bench.json", baselinePath;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		string arg = argv[i], value = argv[i + 1];
+		if (arg == "--sizes") sizes = splitList(value);
+		else if (arg == "--terrains") terrains = splitList(value);
+		else if (arg == "--queries") numQueries = std::max(1, atoi(value.c_str()));
+		else if (arg == "--threads") numThreads = std::max(1, atoi(value.c_str()));
+		else if (arg == "--out") outPath = value;
+		else if (arg == "--baseline") baselinePath = value;
+		else if (arg == "--tolerance") tolerance = atof(value.c_str());
+		else {
+			cout << "unknown option " << arg << endl;
+			return 2;
+		}
+	}
+
+	FILE *fp = fopen(outPath.c_str(), "w");
+	if (!fp) {
+		cout << "Could not write " << outPath << endl;
+		return 2;
+	}
+#if defined(OCTREE_AVX)
+	const char *simd = "avx";
+#elif defined(OCTREE_SSE)
+	const char *simd = "sse2";
+#else
+	const char *simd = "scalar";
+#endif
+	fprintf(fp, "{\n  \"benchmark\": \"octree\", \"version\": 1, \"simd\": \"%s\", \"threads\": %d, \"queries\": %d,\n  \"results\": [\n",
+		simd, numThreads, numQueries);
+
+	vector<Result> results;
+	for (int t = 0; t < terrains.size(); t++) {
+		for (int s = 0; s < sizes.size(); s++) {
+			int numVertices = atoi(sizes[s].c_str());
+			ofSeedRandom(1);
+			ofMesh mesh;
+			if (terrains[t] == "fractal") makeFractal(mesh, numVertices);
+			else if (terrains[t] == "cloud") makeCloud(mesh, numVertices);
+			else if (terrains[t] == "craters") makeCraters(mesh, numVertices);
+			else {
+				cout << "unknown terrain " << terrains[t] << endl;
+				continue;
+			}
+			QuerySet queries;
+			queries.make(mesh, numQueries);
+
+			// the brute force answers as many queries as about 2e8 triangle
+			// (or vertex) tests take, at least 20
+			//
+			int numRef = std::min(numQueries, std::max(20, (int)(2e8 / std::max<size_t>(1, mesh.getNumVertices()))));
+			cout << terrains[t] << " " << mesh.getNumVertices() << " vertices, " << MeshView(mesh).numFaces() << " triangles" << endl;
+
+			Reference ref;
+			BruteForce brute;
+			Octree points, lazyPoints, faces;
+			points.maxLeafPoints = 8;
+			points.bKeepTree = false;
+			lazyPoints.maxLeafPoints = 8;
+			lazyPoints.bKeepTree = false;
+			lazyPoints.bLazy = true;
+			faces.bUseFaces = true;
+			faces.bKeepTree = false;
+			Bvh bvh;
+			SpatialIndex *indices[7] = { &brute, &points, &lazyPoints, &faces, &bvh, nullptr, nullptr };
+			for (int i = 0; i < 7; i++) {
+				Result r;
+				if (i == 5) r = benchmarkCompact(points, queries, numQueries);
+				else if (i == 6) r = benchmarkCompact(faces, queries, numQueries);
+				else r = benchmark(*indices[i], mesh, queries, numQueries, numThreads, ref, numRef);
+				r.terrain = terrains[t];
+				cout << "  " << r.index << ": build " << r.buildMs << "ms (peak " << r.buildPeak / 1024 << "KB), "
+					<< r.memory / 1024 << "KB, queries/s: ray " << (int)r.ray.qps << " box " << (int)r.box.qps << " box list ";
+				if (r.boxList.bRun) cout << (int)r.boxList.qps;
+				else cout << "n/a";
+				cout << " knn ";
+				if (r.knn.bRun) cout << (int)r.knn.qps;
+				else cout << "n/a";
+				if (r.coherent.bRun) {
+					cout << " coherent " << (int)r.coherent.qps << " packets";
+					for (int p = 0; p < 3; p++) cout << " " << (int)r.packet[p].qps;
+				}
+				int errors = r.ray.errors + r.box.errors + r.boxList.errors + r.knn.errors;
+				for (int p = 0; p < 3; p++) errors += r.packet[p].errors;
+				cout << ", errors " << errors << endl;
+				results.push_back(r);
+			}
+		}
+	}
+	for (int i = 0; i < results.size(); i++) writeResult(fp, results[i], i + 1 == results.size());
+	fprintf(fp, "  ]\n}\n");
+	fclose(fp);
+	cout << "Wrote " << outPath << endl;
+
+	// regressions against an earlier run: query rates down by more than
+	// the tolerance
+	//
+	int regressions = 0;
+	if (!baselinePath.empty()) {
+		map<string, vector<double>> baseline = readBaseline(baselinePath);
+		for (int i = 0; i < results.size(); i++) {
+			auto b = baseline.find(results[i].key());
+			if (b == baseline.end()) continue;
+			const Result & r = results[i];
+			double now[NumKinds] = { r.ray.qps, r.box.qps, r.boxList.qps, r.knn.qps, r.coherent.qps,
+				r.packet[0].qps, r.packet[1].qps, r.packet[2].qps };
+			for (int k = 0; k < NumKinds; k++) {
+				if (b->second[k] <= 0 || now[k] <= 0) continue;
+				double ratio = now[k] / b->second[k];
+				if (ratio >= 1 - tolerance / 100) continue;
+				cout << "regression: " << results[i].key() << " " << kinds[k] << " " << (int)b->second[k] << " -> "
+					<< (int)now[k] << " queries/s (" << (int)(ratio * 100) << "%)" << endl;
+				regressions++;
+			}
+		}
+		cout << regressions << " regressions against " << baselinePath << endl;
+	}
+	return regressions > 0 ? 1 : 0;
+}
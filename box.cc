@@ -13,6 +13,13 @@
  */
 
 bool Box::intersect(const Ray &r, float t0, float t1) const {
+  float tEnter;
+  return intersect(r, t0, t1, tEnter);
+}
+
+// same test, also returning the distance at which the ray enters the box
+// (t0 when the ray starts inside it)
+bool Box::intersect(const Ray &r, float t0, float t1, float &tEnter) const {
   float tmin, tmax, tymin, tymax, tzmin, tzmax;
 
   tmin = (parameters[r.sign[0]].x() - r.origin.x()) * r.inv_direction.x();
@@ -33,5 +40,6 @@ bool Box::intersect(const Ray &r, float t0, float t1) const {
     tmin = tzmin;
   if (tzmax < tmax)
     tmax = tzmax;
+  tEnter = (tmin > t0) ? tmin : t0;
   return ( (tmin < t1) && (tmax > t0) );
 }
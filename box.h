@@ -25,29 +25,28 @@ class Box {
     }
     // (t0, t1) is the interval for valid hits
     bool intersect(const Ray &, float t0, float t1) const;
+    bool intersect(const Ray &, float t0, float t1, float &tEnter) const;
 
     // corners
     Vector3 parameters[2];
 
-	Vector3 min() { return parameters[0]; }
-	Vector3 max() { return parameters[1]; }
-	const bool inside(const Vector3 &p) {
+	Vector3 min() const { return parameters[0]; }
+	Vector3 max() const { return parameters[1]; }
+	const bool inside(const Vector3 &p) const {
 		return ((p.x() >= parameters[0].x() && p.x() <= parameters[1].x()) &&
 		     	(p.y() >= parameters[0].y() && p.y() <= parameters[1].y()) &&
 			    (p.z() >= parameters[0].z() && p.z() <= parameters[1].z()));
 	}
-	const bool inside(Vector3 *points, int size) {
-		bool allInside = true;
+	const bool inside(const Vector3 *points, int size) const {
 		for (int i = 0; i < size; i++) {
-			if (!inside(points[i])) allInside = false;
-			break;
+			if (!inside(points[i])) return false;
 		}
-		return allInside;
+		return true;
 	}
 
 	// implement for Homework Project
 	//
-	 inline bool overlap(const Box &box) {
+	 inline bool overlap(const Box &box) const {
 		 if (min().x() <= box.parameters[1].x() && max().x() >= box.parameters[0].x() &&
 			 min().y() <= box.parameters[1].y() && max().y() >= box.parameters[0].y() &&
 			 min().z() <= box.parameters[1].z() && max().z() >= box.parameters[0].z()) {
@@ -56,7 +55,7 @@ class Box {
 		 return false;
 	}
 
-	Vector3 center() {
+	Vector3 center() const {
 		return ((max() - min()) / 2 + min());
 	}
 };
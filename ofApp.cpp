@@ -127,12 +127,62 @@ void ofApp::setup() {
 	gui.add(numLevels.setup("Number of Octree Levels", 1, 1, 10));
 	bHide = false;
 
-	//  Create Octree for testing.
+	//  Create Octree for testing.  The terrain is the model's own mesh (not
+	//  a copy from getMesh()), and both octrees index it in place; the point
+	//  octree keeps just packed positions, which it needs to move its points
+	//  (craters).
 	//
+	terrainMesh = &mars.getMeshHelper(0).cachedMesh;
 
-	octree.create(mars.getMesh(0), 20);
+	// tiled terrain: only the tiles around the lander and camera are in
+	// memory, so none of the structures over the whole mesh are built.
+	// The tiles are cut from the model the first time.
+	//
+	if (bTerrainTiles) {
+		string tileDir = ofToDataPath("geo/moon-houdini-tiles");
+		if (!tiles.open(tileDir) && TerrainTiles::split(*terrainMesh, tileDir, tiles.tileSize)) tiles.open(tileDir);
+		terrain = &tiles;
+	}
+	else {
+		// leaves of up to 8 points: the tree adapts its depth to the vertex
+		// density and is several times smaller and faster to build than one
+		// point per leaf (see Octree::benchmarkLeafCapacity(), key 'l')
+		//
+		octree.bKeepTree = false;
+		octree.maxLeafPoints = 8;
+		octree.bPackVertices = true;
+		octree.createCached(ofToDataPath("geo/moon-houdini.octree"), MeshView(*terrainMesh), 20, thread::hardware_concurrency());
+		faceOctree.bUseFaces = true;
+		faceOctree.bKeepTree = false;
+		faceOctree.createCached(ofToDataPath("geo/moon-houdini-faces.octree"), MeshView(*terrainMesh), 20, thread::hardware_concurrency());
+		octree.printReport();
+		faceOctree.printReport();
+
+		// altitude and ground contact are lookups in the heightfield; the
+		// octrees answer only where the terrain has overhangs
+		//
+		ground.build(*terrainMesh);
 
-	cout << "Number of Verts: " << mars.getMesh(0).getNumVertices() << endl;
+		// render chunks, one per faceOctree node at chunkLevel, sharing the
+		// terrain's vertex buffer
+		//
+		terrainChunks.build(faceOctree, chunkLevel, mars.getMeshHelper(0).vbo.getVbo());
+
+		// picking, collisions and clearance go through the SpatialIndex
+		// interface, so the terrain index is chosen here at startup
+		//
+		if (bTerrainBvh) {
+			bvh.build(*terrainMesh, thread::hardware_concurrency());
+			terrain = &bvh;
+		}
+
+		// build the update tables now so that carving a crater doesn't stall a frame
+		//
+		octree.prepareUpdates();
+		faceOctree.prepareUpdates();
+	}
+
+	cout << "Number of Verts: " << terrainMesh->getNumVertices() << endl;
 
 	testBox = Box(Vector3(3, 3, 0), Vector3(5, 5, 2));
 
@@ -228,6 +278,10 @@ void ofApp::update() {
 	top.setPosition(lander.getPosition().x, lander.getPosition().y + 25, lander.getPosition().z);
 	top.lookAt(lander.getPosition());
 
+	// page terrain tiles in around the lander and the active camera
+	//
+	if (bTerrainTiles) tiles.update({ ofVec3f(lander.getPosition()), ofVec3f(theCam->getPosition()) });
+
 	// update lander
 	if (bLanderLoaded && !bLanderSelected) {
 		if (fuel <= 0) {
@@ -235,54 +289,38 @@ void ofApp::update() {
 			bFuel = false;
 		}
 		landerSys->particles[0].position = lander.getPosition();
-		if (checkCollisions()) {
-			bLanded = true;
-			float restitution = 0.6;
-			landerSys->particles[0].velocity.y *= -restitution;
-			// lander has landed
-			if (bLanded) {
-				ofVec3f min = lander.getSceneMin() + lander.getPosition();
-				ofVec3f max = lander.getSceneMax() + lander.getPosition();
-
-				Box bounds = Box(Vector3(min.x, min.y, min.z), Vector3(max.x, max.y, max.z));
-				// landed in landing area
-				if (bounds.overlap(landingBox)) {
-					landedInBox = true;
-					if (landerSys->particles[0].velocity.y < 3 && landerSys->particles[0].velocity.y > 0) {
-						softLanding = true;
-						finalScore = fuel + 100;
-						// debug statement cout << "it works" << endl;
-					}
-				}
-				else {
-					landedOutsideBox = true;
-				}
-			}
-
-			// lander going too fast
-			if (landerSys->particles[0].velocity.y > 5) {
-				// lander explodes
-				impulseForce = new ImpulseForce(ofVec3f(0, 3000, 0));
-				impulseForce->applyOnce = true;
-				landerSys->addForce(impulseForce);
-				explosion.sys->reset();
-				explosion.start();
-				explosionSound.play(); 
-				// debug statement cout << "explosion" << endl;
-				gameOver = true;
-			}
-
-			// landing a little hard
-			else if (landerSys->particles[0].velocity.y > 3 && landedInBox) {
-				roughLanding = true;
-				// debug statement cout << "hard landing" << endl;
-				finalScore = (fuel / 100) + 75;
-			}
-
-		}
+		// resting on the terrain, or pushed into it by a step the sweep
+		// below did not stop: bounce if still moving down
+		//
+		if (checkCollisions() && landerSys->particles[0].velocity.y <= 0)
+			touchdown(-landerSys->particles[0].velocity.y);
 
 		// update particle system and emitters
+		ofVec3f lastPosition = landerSys->particles[0].position;
 		landerSys->update();
+
+		// stop the lander where its box first touches a terrain triangle this
+		// frame so that a fast descent or a long frame can't tunnel through
+		// it, and take away the part of its velocity going into the surface
+		// so it slides or rests instead of pushing in again next frame.  The
+		// point octree has no triangles, so the face octree stands in for it.
+		// A contact this frame bounces it and decides the landing at the
+		// speed it hit at.
+		//
+		SpatialIndex *surface = (terrain == &octree) ? &faceOctree : terrain;
+		ofVec3f move = landerSys->particles[0].position - lastPosition;
+		ofVec3f min = lander.getSceneMin() + lastPosition;
+		ofVec3f max = lander.getSceneMax() + lastPosition;
+		RayHit contact;
+		if (surface->intersectSwept(Box(Vector3(min.x, min.y, min.z), Vector3(max.x, max.y, max.z)),
+			Vector3(move.x, move.y, move.z), contact)) {
+			ofVec3f normal(contact.normal.x(), contact.normal.y(), contact.normal.z());
+			ofVec3f & velocity = landerSys->particles[0].velocity;
+			float into = velocity.dot(normal);
+			if (into < 0) velocity -= normal * into;
+			landerSys->particles[0].position = lastPosition + move * contact.t;
+			if (into < 0) touchdown(-into);
+		}
 		lander.setPosition(landerSys->particles[0].position.x, landerSys->particles[0].position.y, landerSys->particles[0].position.z);
 		lander.setRotation(0, landerSys->particles[0].rotation, 0, 1, 0);
 		rocketExhaust.setPosition(landerSys->particles[0].position);
@@ -292,6 +330,8 @@ void ofApp::update() {
 
 		// update altitude of lander
 		altitude = getAltitude();
+		vector<PointHit> nearest;
+		if (terrain->knn(landerSys->particles[0].position, 1, nearest)) clearance = nearest[0].dist;
 	}
 }
 //--------------------------------------------------------------
@@ -320,7 +360,24 @@ void ofApp::draw() {
 	}
 	else {
 		ofEnableLighting();              // shaded mode
-		mars.drawFaces();
+
+		// the terrain mesh with the model's and its own transform, texture
+		// and material, as mars.drawFaces() draws it, but chunk by chunk (or
+		// tile by tile)
+		//
+		ofxAssimpMeshHelper & terrainHelper = mars.getMeshHelper(0);
+		glm::mat4 terrainMatrix = mars.getModelMatrix() * glm::mat4(terrainHelper.matrix);
+		bool bTexture = terrainHelper.hasTexture();
+		if (bTexture) terrainHelper.getTextureRef().bind();
+		terrainHelper.material.begin();
+		ofPushMatrix();
+		ofMultMatrix(terrainMatrix);
+		if (bTerrainTiles) tiles.draw();
+		else if (bCullTerrain) terrainChunks.draw(Frustum(theCam->getModelViewProjectionMatrix() * terrainMatrix));
+		else terrainChunks.drawAll();
+		ofPopMatrix();
+		terrainHelper.material.end();
+		if (bTexture) terrainHelper.getTextureRef().unbind();
 		ofMesh mesh;
 		ofNoFill();
 		ofSetColor(ofColor::blue);
@@ -404,10 +461,9 @@ void ofApp::draw() {
 	// if point selected, draw a sphere
 	//
 	if (pointSelected) {
-		ofVec3f p = octree.mesh.getVertex(selectedNode.points[0]);
-		ofVec3f d = p - cam.getPosition();
+		ofVec3f d = pickedPoint - cam.getPosition();
 		ofSetColor(ofColor::lightGreen);
-		ofDrawSphere(p, .02 * d.length());
+		ofDrawSphere(pickedPoint, .02 * d.length());
 	}
 
 	ofPopMatrix();
@@ -454,6 +510,20 @@ void ofApp::draw() {
 	ofSetColor(ofColor::white);
 	ofDrawBitmapString(altitudeText, ofGetWindowWidth() / 2 + 300, 40);
 
+	string clearanceText;
+	clearanceText += "Terrain Clearance: " + to_string(clearance);
+	ofDrawBitmapString(clearanceText, ofGetWindowWidth() / 2 + 300, 80);
+
+	string terrainText;
+	terrainText += "Terrain: " + to_string(terrainChunks.drawCalls) + " draw calls, " +
+		to_string(terrainChunks.chunksDrawn) + " / " + to_string(terrainChunks.chunks.size()) + " chunks, " +
+		to_string(terrainChunks.trianglesDrawn) + " triangles" + (bCullTerrain ? "" : " (culling off)");
+	if (bTerrainTiles) {
+		terrainText = "Terrain: " + to_string(tiles.tiles.size()) + " tiles, " + to_string(tiles.memoryUsage() / 1024) + "KB, " +
+			to_string(tiles.tilesLoaded) + " loaded, " + to_string(tiles.tilesEvicted) + " evicted";
+	}
+	ofDrawBitmapString(terrainText, ofGetWindowWidth() / 2 + 300, 100);
+
 	string currentFuel;
 	currentFuel += "Current Fuel: " + to_string(fuel) + " / 120 seconds";
 	ofSetColor(ofColor::white);
@@ -543,6 +613,26 @@ void ofApp::keyPressed(int key) {
 		break;
 	case 'u':
 		break;
+	case 'b':
+		Octree::benchmarkBuild(*terrainMesh, 20, thread::hardware_concurrency());
+		break;
+	case 'l':
+		Octree::benchmarkLeafCapacity(*terrainMesh, 20);
+		break;
+	case 'k':
+		bCullTerrain = !bCullTerrain;
+		break;
+	case 'i': {
+		// compare the terrain indices on this mesh
+		Octree points, faces;
+		points.maxLeafPoints = 8;
+		faces.bUseFaces = true;
+		SpatialIndex::benchmark(points, *terrainMesh, thread::hardware_concurrency());
+		SpatialIndex::benchmark(faces, *terrainMesh, thread::hardware_concurrency());
+		Bvh tris;
+		SpatialIndex::benchmark(tris, *terrainMesh);
+		break;
+	}
 	case ' ':
 		gameOver = false;
 		landedInBox = false;
@@ -787,12 +877,17 @@ bool ofApp::raySelectWithOctree(ofVec3f& pointRet) {
 	Ray ray = Ray(Vector3(rayPoint.x, rayPoint.y, rayPoint.z),
 		Vector3(rayDir.x, rayDir.y, rayDir.z));
 	//time to search data with ray intersection in microseconds
+	Octree::resetStats();
 	float start = ofGetElapsedTimeMicros();
-	pointSelected = octree.intersect(ray, octree.root, selectedNode);
+	RayHit hit;
+	pointSelected = terrain->intersect(ray, hit);
 	float finish = ofGetElapsedTimeMicros() - start;
 	cout << "Finished intersection\nIntersection time: " << finish << " microseconds" << endl;
+	if (terrain == &octree) Octree::stats().print();	// only the octree counts its visits
 	if (pointSelected) {
-		pointRet = octree.mesh.getVertex(selectedNode.points[0]);
+		selectedNode = hit.node;
+		pickedPoint = ofVec3f(hit.point.x(), hit.point.y(), hit.point.z());
+		pointRet = pickedPoint;
 	}
 	return pointSelected;
 }
@@ -824,7 +919,7 @@ void ofApp::mouseDragged(int x, int y, int button) {
 		Box bounds = Box(Vector3(min.x, min.y, min.z), Vector3(max.x, max.y, max.z));
 
 		colBoxList.clear();
-		octree.intersect(bounds, octree.root, colBoxList);
+		terrain->intersect(bounds, colBoxList);
 
 
 		/*if (bounds.overlap(testBox)) {
@@ -1043,10 +1138,19 @@ glm::vec3 ofApp::getMousePointOnPlane(glm::vec3 planePt, glm::vec3 planeNorm) {
 }
 
 float ofApp::getAltitude() {
+	float h;
+	if (!bTerrainTiles && ground.height(lander.getPosition().x, lander.getPosition().z, h)) return lander.getPosition().y - h;
+
 	Ray aRay = Ray(Vector3(lander.getPosition().x, lander.getPosition().y, lander.getPosition().z), Vector3(0, -1, 0));
-	octree.intersect(aRay, octree.root, selectedNode);
-	glm::vec3 p = mars.getMesh(0).getVertex(selectedNode.points[0]);
-	return glm::length(p - lander.getPosition());
+	RayHit hit;
+	SpatialIndex *exact = bTerrainTiles ? terrain : &faceOctree;
+	if (exact->intersect(aRay, hit)) return hit.t;
+
+	// no terrain straight down (off the edge of a slope): use the distance
+	// to the closest terrain point instead
+	vector<PointHit> nearest;
+	if (terrain->knn(lander.getPosition(), 1, nearest)) return nearest[0].dist;
+	return altitude;
 }
 
 bool ofApp::checkCollisions() {
@@ -1054,23 +1158,126 @@ bool ofApp::checkCollisions() {
 	ofVec3f max = lander.getSceneMax() + lander.getPosition();
 
 	Box bounds = Box(Vector3(min.x, min.y, min.z), Vector3(max.x, max.y, max.z));
-	colBoxList.clear();
-	octree.intersect(bounds, octree.root, colBoxList);
-
-	// collision detection with terrain and lander
-	for (int i = 0; i < colBoxList.size(); i++) {
-		if (bounds.overlap(colBoxList[i])) {
-			//take top of terrain
-			ofVec3f topOfTerrain = ofVec3f(colBoxList[i].parameters[0].x(), colBoxList[i].parameters[1].y(), colBoxList[i].parameters[0].z());
-			//take bottom of lander
-			ofVec3f bottomOfLander = ofVec3f(landerSys->particles[0].position.x, landerSys->particles[0].position.y, landerSys->particles[0].position.z);
-			// calculate collision and also adjust so lander does not go through terrain
-			float collision = bottomOfLander.y - topOfTerrain.y;
-			landerSys->particles[0].position.y -= collision - 0.03;
-
-			// debug satatement cout << landerSys->particles[0].velocity.y << endl;
-			return true;
+
+	// collision detection with terrain and lander: contact, and the top of
+	// the terrain under the lander.  The heightfield answers unless there
+	// is an overhang below, and then the terrain index does.
+	float topOfTerrain;
+	if (!bTerrainTiles && ground.maxHeight(bounds, topOfTerrain)) {
+		if (topOfTerrain < bounds.min().y()) return false;
+	}
+	else if (!terrain->intersectTop(bounds, topOfTerrain)) return false;
+
+	//take bottom of lander
+	float bottomOfLander = landerSys->particles[0].position.y;
+	// calculate collision and also adjust so lander does not go through terrain
+	float collision = bottomOfLander - topOfTerrain;
+	landerSys->particles[0].position.y -= collision - 0.03;
+
+	// debug satatement cout << landerSys->particles[0].velocity.y << endl;
+	return true;
+}
+
+// touchdown:  the lander hit the terrain at "impact" (speed into the
+//             surface): bounce it, and score a landing or crash it
+//
+void ofApp::touchdown(float impact) {
+	bLanded = true;
+	float restitution = 0.6;
+	landerSys->particles[0].velocity.y = impact * restitution;
+
+	// lander has landed
+	ofVec3f min = lander.getSceneMin() + landerSys->particles[0].position;
+	ofVec3f max = lander.getSceneMax() + landerSys->particles[0].position;
+
+	Box bounds = Box(Vector3(min.x, min.y, min.z), Vector3(max.x, max.y, max.z));
+	// landed in landing area
+	if (bounds.overlap(landingBox)) {
+		landedInBox = true;
+		if (landerSys->particles[0].velocity.y < 3 && landerSys->particles[0].velocity.y > 0) {
+			softLanding = true;
+			finalScore = fuel + 100;
+			// debug statement cout << "it works" << endl;
+		}
+	}
+	else {
+		landedOutsideBox = true;
+	}
+
+	// lander going too fast
+	if (landerSys->particles[0].velocity.y > 5) {
+		// lander explodes
+		impulseForce = new ImpulseForce(ofVec3f(0, 3000, 0));
+		impulseForce->applyOnce = true;
+		landerSys->addForce(impulseForce);
+		explosion.sys->reset();
+		explosion.start();
+		explosionSound.play(); 
+		// debug statement cout << "explosion" << endl;
+		if (!gameOver) {
+			float size = (lander.getSceneMax() - lander.getSceneMin()).length();
+			carveCrater(landerSys->particles[0].position, size, size / 4);
 		}
+		gameOver = true;
+	}
+
+	// landing a little hard
+	else if (landerSys->particles[0].velocity.y > 3 && landedInBox) {
+		roughLanding = true;
+		// debug statement cout << "hard landing" << endl;
+		finalScore = (fuel / 100) + 75;
 	}
-	return false;
+}
+
+// carveCrater:  push the terrain down in a bowl of "radius" around "center",
+//               update the octrees and heightfield in place and upload only
+//               the range of vertices that changed to the terrain's vertex
+//               buffer.  Tiled terrain is carved in the resident tiles.
+//
+void ofApp::carveCrater(const ofVec3f & center, float radius, float depth) {
+	Box area(Vector3(center.x - radius, -FLT_MAX, center.z - radius),
+		Vector3(center.x + radius, FLT_MAX, center.z + radius));
+	auto bowl = [&](ofVec3f & p) {
+		float d2 = (p.x - center.x) * (p.x - center.x) + (p.z - center.z) * (p.z - center.z);
+		if (d2 >= radius * radius) return false;
+		p.y -= depth * (1 - d2 / (radius * radius));
+		return true;
+	};
+	pointSelected = false;
+	if (bTerrainTiles) {
+		tiles.displace(area, bowl);
+		return;
+	}
+
+	const Box & bounds = octree.nodeData[0].box;
+	vector<int> candidates;
+	octree.getPointsInBox(area, candidates);
+
+	vector<int> verts;
+	vector<ofVec3f> pos;
+	int lo = INT_MAX, hi = -1;
+	for (int i = 0; i < candidates.size(); i++) {
+		ofVec3f p = terrainMesh->getVertex(candidates[i]);
+		if (!bowl(p)) continue;
+
+		// keep the floor inside the octree so every point can be reinserted
+		p.y = std::max(p.y, bounds.min().y());
+		verts.push_back(candidates[i]);
+		pos.push_back(p);
+		lo = std::min(lo, candidates[i]);
+		hi = std::max(hi, candidates[i]);
+	}
+	if (verts.empty()) return;
+
+	// the face octree reads terrainMesh, so it is moved first
+	//
+	for (int i = 0; i < verts.size(); i++) terrainMesh->setVertex(verts[i], pos[i]);
+	octree.moveVertices(verts, pos);
+	faceOctree.moveVertices(verts, pos);
+	if (terrain != &octree) terrain->moveVertices(verts, pos);
+	ground.update(*terrainMesh, center.x - radius, center.z - radius, center.x + radius, center.z + radius);
+
+	ofVbo & vbo = mars.getMeshHelper(0).vbo.getVbo();
+	vbo.getVertexBuffer().updateData(lo * sizeof(glm::vec3), (hi - lo + 1) * sizeof(glm::vec3),
+		terrainMesh->getVerticesPointer() + lo);
 }
\ No newline at end of file
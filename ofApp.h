@@ -4,6 +4,10 @@
 #include "ofxGui.h"
 #include  "ofxAssimpModelLoader.h"
 #include "Octree.h"
+#include "Bvh.h"
+#include "Heightfield.h"
+#include "TerrainChunks.h"
+#include "TerrainTiles.h"
 #include "Particle.h"
 #include "ParticleEmitter.h"
 #include <glm/gtx/intersect.hpp>
@@ -38,15 +42,18 @@ public:
 	void toggleSelectTerrain();
 	void setCameraTarget();
 	bool checkCollisions();
+	void touchdown(float impact);
 	bool mouseIntersectPlane(ofVec3f planePoint, ofVec3f planeNorm, ofVec3f& point);
 	bool raySelectWithOctree(ofVec3f& pointRet);
 	glm::vec3 ofApp::getMousePointOnPlane(glm::vec3 p, glm::vec3 n);
 	float getAltitude();
+	void carveCrater(const ofVec3f & center, float radius, float depth);
 
 	ofEasyCam cam;
 	ofCamera top, cam1, cam2;
 	ofCamera* theCam;
 	ofxAssimpModelLoader mars, lander;
+	ofMesh *terrainMesh = nullptr;	// the model's terrain mesh: the octrees read it in place
 	ofLight light;
 	Box boundingBox, landerBounds;
 	Box landingBox;
@@ -54,7 +61,18 @@ public:
 	vector<Box> colBoxList;
 	bool bLanderSelected = false;
 	Octree octree;
-	TreeNode selectedNode;
+	Octree faceOctree;		// triangle octree for exact ground hits
+	Heightfield ground;		// terrain heights for altitude and ground contact
+	TerrainChunks terrainChunks;	// terrain split by faceOctree nodes for culling
+	int chunkLevel = 4;		// faceOctree level of the chunks
+	bool bCullTerrain = true;	// draw only the chunks in the camera's view
+	Bvh bvh;			// triangle BVH, the alternative terrain index
+	SpatialIndex *terrain = &octree;	// index used for picking and collisions
+	bool bTerrainBvh = false;	// set to use the BVH instead of the octree
+	TerrainTiles tiles;		// terrain paged in around the lander
+	bool bTerrainTiles = false;	// set to fly over the tiles instead of the model
+	int selectedNode = -1;		// node picked by raySelectWithOctree()
+	ofVec3f pickedPoint;		// and the terrain point picked in it
 	glm::vec3 mouseDownPos, mouseLastPos;
 	bool bInDrag = false;
 
@@ -94,6 +112,7 @@ public:
 	bool roughLanding = false;
 	bool thrusterOn = false;
 	float altitude;
+	float clearance = 0;	// distance from the lander to the nearest terrain point
 	float finalScore;
 	float angle;
 	float fuel = 10;